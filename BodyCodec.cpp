@@ -0,0 +1,154 @@
+#include "BodyCodec.hpp"
+
+#include <stdexcept>
+
+namespace BodyCodec {
+
+enum Step : uint8_t {
+	StepLeft = 0,
+	StepRight = 1,
+	StepUp = 2,
+	StepDown = 3,
+	StepStay = 4,
+	StepZ = 5,
+	StepEscape = 7,
+};
+
+static uint32_t zigzag(int32_t val) {
+	return (uint32_t(val) << 1) ^ uint32_t(val >> 31);
+}
+
+static int32_t unzigzag(uint32_t val) {
+	return int32_t(val >> 1) ^ -int32_t(val & 1);
+}
+
+void write_varint(std::vector< uint8_t > &out, uint32_t val) {
+	while (val >= 0x80) {
+		out.emplace_back(uint8_t(val) | 0x80);
+		val >>= 7;
+	}
+	out.emplace_back(uint8_t(val));
+}
+
+size_t read_varint(uint8_t const *data, size_t size, uint32_t *val_) {
+	uint32_t val = 0;
+	for (size_t i = 0; i < 5; ++i) {
+		if (i >= size) throw std::runtime_error("Ran out of bytes reading varint.");
+		uint8_t b = data[i];
+		if (i == 4 && (b & 0xf0)) throw std::runtime_error("Varint too large.");
+		val |= uint32_t(b & 0x7f) << (7 * i);
+		if (!(b & 0x80)) {
+			*val_ = val;
+			return i + 1;
+		}
+	}
+	throw std::runtime_error("Varint too long.");
+}
+
+//x/y part of a step, or StepEscape if it isn't one grid step (or none):
+static uint8_t xy_step(glm::ivec3 const &d) {
+	if (d.y == 0) {
+		if (d.x == -1) return StepLeft;
+		if (d.x == 1) return StepRight;
+		if (d.x == 0) return StepStay;
+	} else if (d.x == 0) {
+		if (d.y == 1) return StepUp;
+		if (d.y == -1) return StepDown;
+	}
+	return StepEscape;
+}
+
+void write_steps(std::vector< uint8_t > &out, glm::ivec3 from, glm::ivec3 const *blocks, size_t count) {
+	//codes and side stream are built separately, since the code count goes first:
+	std::vector< uint8_t > codes;
+	std::vector< uint8_t > side;
+	codes.reserve(count);
+
+	glm::ivec3 prev = from;
+	for (size_t i = 0; i < count; ++i) {
+		glm::ivec3 d = blocks[i] - prev;
+		uint8_t step = xy_step(d);
+		if (step == StepEscape) {
+			codes.emplace_back(StepEscape);
+			write_varint(side, zigzag(d.x));
+			write_varint(side, zigzag(d.y));
+			write_varint(side, zigzag(d.z));
+		} else {
+			if (d.z != 0) {
+				codes.emplace_back(StepZ);
+				write_varint(side, zigzag(d.z));
+			}
+			codes.emplace_back(step);
+		}
+		prev = blocks[i];
+	}
+
+	write_varint(out, uint32_t(codes.size()));
+	size_t packed = out.size();
+	out.resize(packed + (codes.size() * 3 + 7) / 8, 0);
+	for (size_t c = 0; c < codes.size(); ++c) {
+		size_t bit = c * 3;
+		uint32_t shifted = uint32_t(codes[c]) << (bit % 8);
+		out[packed + bit / 8] |= uint8_t(shifted);
+		if (shifted > 0xff) out[packed + bit / 8 + 1] |= uint8_t(shifted >> 8);
+	}
+	out.insert(out.end(), side.begin(), side.end());
+}
+
+size_t read_steps(uint8_t const *data, size_t size, glm::ivec3 from, size_t count, std::vector< glm::ivec3 > *blocks) {
+	uint32_t code_count;
+	size_t at = read_varint(data, size, &code_count);
+	//every block takes at most two codes:
+	if (code_count < count || code_count > 2 * count) throw std::runtime_error("Bad code count in body steps.");
+
+	uint8_t const *packed = data + at;
+	size_t packed_size = (size_t(code_count) * 3 + 7) / 8;
+	if (packed_size > size - at) throw std::runtime_error("Ran out of bytes reading body steps.");
+	at += packed_size;
+
+	auto code = [&](size_t c) -> uint8_t {
+		size_t bit = c * 3;
+		uint32_t word = packed[bit / 8];
+		if (bit / 8 + 1 < packed_size) word |= uint32_t(packed[bit / 8 + 1]) << 8;
+		return uint8_t((word >> (bit % 8)) & 0x7);
+	};
+	auto side = [&]() -> int32_t {
+		uint32_t val;
+		at += read_varint(data + at, size - at, &val);
+		return unzigzag(val);
+	};
+
+	blocks->reserve(blocks->size() + count);
+	glm::ivec3 prev = from;
+	size_t c = 0;
+	for (size_t i = 0; i < count; ++i) {
+		if (c >= code_count) throw std::runtime_error("Ran out of codes reading body steps.");
+		uint8_t step = code(c++);
+		glm::ivec3 d(0);
+		if (step == StepZ) {
+			d.z = side();
+			if (c >= code_count) throw std::runtime_error("Ran out of codes reading body steps.");
+			step = code(c++);
+			if (step > StepStay) throw std::runtime_error("Bad step after z change in body steps.");
+		}
+		if (step == StepLeft) d.x = -1;
+		else if (step == StepRight) d.x = 1;
+		else if (step == StepUp) d.y = 1;
+		else if (step == StepDown) d.y = -1;
+		else if (step == StepStay) { /* nothing */ }
+		else if (step == StepEscape) {
+			d.x = side();
+			d.y = side();
+			d.z = side();
+		} else {
+			throw std::runtime_error("Unknown code in body steps.");
+		}
+		prev += d;
+		blocks->emplace_back(prev);
+	}
+	if (c != code_count) throw std::runtime_error("Extra codes in body steps.");
+
+	return at;
+}
+
+}
@@ -0,0 +1,44 @@
+#pragma once
+
+/*
+ * BodyCodec packs runs of snake body blocks for state messages.
+ *
+ * Consecutive blocks of a body are almost always one grid step apart, so
+ * instead of a 12-byte glm::ivec3 per block, each block is sent as a 3-bit
+ * step code relative to the block before it:
+ *
+ *   0: x-1  1: x+1  2: y+1  3: y-1  4: same cell
+ *   5: z change -- a zigzag varint dz follows in the side stream, and the next code (0-4) gives the x/y step
+ *   7: escape -- zigzag varint dx, dy, dz follow in the side stream (anything else, e.g. the first block)
+ *
+ * A run of blocks is written as:
+ *   [code count:varint][codes, 3 bits each, packed LSB-first][side stream varints, in code order]
+ *
+ *   std::vector< uint8_t > out;
+ *   BodyCodec::write_steps(out, glm::ivec3(0), body.data(), body.size());
+ *   ...
+ *   std::vector< glm::ivec3 > body;
+ *   size_t used = BodyCodec::read_steps(data, size, glm::ivec3(0), count, &body);
+ */
+
+#include <glm/glm.hpp>
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+
+namespace BodyCodec {
+
+//LEB128 unsigned varint:
+void write_varint(std::vector< uint8_t > &out, uint32_t val);
+//returns bytes read; throws std::runtime_error if data runs out or the value doesn't fit:
+size_t read_varint(uint8_t const *data, size_t size, uint32_t *val);
+
+//append blocks[0..count) as steps starting from 'from':
+void write_steps(std::vector< uint8_t > &out, glm::ivec3 from, glm::ivec3 const *blocks, size_t count);
+
+//read 'count' blocks written by write_steps (with the same 'from'), appending them to *blocks;
+// returns bytes read; throws std::runtime_error on malformed data:
+size_t read_steps(uint8_t const *data, size_t size, glm::ivec3 from, size_t count, std::vector< glm::ivec3 > *blocks);
+
+}
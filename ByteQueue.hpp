@@ -0,0 +1,78 @@
+#pragma once
+
+/*
+ * ByteQueue is a FIFO of bytes, used for Connection's send/recv buffers.
+ * Bytes are appended at the back and consumed from the front:
+ *
+ *   queue.append(data, size);
+ *   if (queue.size() >= 4 && queue[0] == 'x') { parse(queue.data(), 4); queue.consume(4); }
+ *
+ * Unconsumed bytes are always contiguous (so data() can be handed to
+ * send() or a parser directly). Consuming just advances a read cursor;
+ * the consumed prefix is reclaimed when the queue empties or when it
+ * makes up at least half of the storage at the next append, so each byte
+ * is moved at most a constant number of times on average.
+ */
+
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <cstring>
+#include <cassert>
+
+struct ByteQueue {
+	//unconsumed bytes, contiguous:
+	uint8_t const *data() const { return storage.data() + head; }
+	uint8_t *data() { return storage.data() + head; }
+	size_t size() const { return storage.size() - head; }
+	bool empty() const { return head == storage.size(); }
+
+	//i-th unconsumed byte:
+	uint8_t const &operator[](size_t i) const { assert(i < size()); return storage[head + i]; }
+	uint8_t &operator[](size_t i) { assert(i < size()); return storage[head + i]; }
+
+	uint8_t const *begin() const { return data(); }
+	uint8_t const *end() const { return data() + size(); }
+
+	//add bytes at the back:
+	void append(void const *bytes, size_t count) {
+		if (head != 0 && head >= storage.size() / 2 && storage.size() + count > storage.capacity()) compact();
+		storage.insert(storage.end(), reinterpret_cast< uint8_t const * >(bytes), reinterpret_cast< uint8_t const * >(bytes) + count);
+	}
+
+	//drop bytes from the front (O(1)):
+	void consume(size_t count) {
+		assert(count <= size());
+		head += count;
+		if (head == storage.size()) clear();
+	}
+
+	void clear() {
+		storage.clear();
+		head = 0;
+	}
+
+	//swap the first 'count' bytes for bytes[0..size) (e.g., a compressed message for what it decodes to):
+	// (written into the consumed prefix when it has room, so the rest of the queue usually stays put)
+	void replace_front(size_t count, void const *bytes, size_t size) {
+		assert(count <= this->size());
+		size_t room = head + count; //(consumed prefix + the bytes being replaced)
+		if (size > room) {
+			storage.insert(storage.begin() + room, size - room, uint8_t(0));
+			room = size;
+		}
+		head = room - size;
+		if (size) std::memcpy(storage.data() + head, bytes, size);
+		if (head == storage.size()) clear();
+	}
+
+	//internals:
+	std::vector< uint8_t > storage;
+	size_t head = 0; //index in storage of the first unconsumed byte
+
+	//move unconsumed bytes to the start of storage:
+	void compact() {
+		storage.erase(storage.begin(), storage.begin() + head);
+		head = 0;
+	}
+};
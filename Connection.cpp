@@ -20,10 +20,13 @@ typedef int ssize_t;
 
 #include <sys/types.h>
 #include <sys/socket.h>
+#include <sys/uio.h>
 #include <arpa/inet.h>
 #include <netinet/ip.h>
+#include <netinet/tcp.h>
 #include <unistd.h>
 #include <netdb.h>
+#include <fcntl.h>
 
 #define closesocket close
 
@@ -31,36 +34,455 @@ typedef int ssize_t;
 
 #include "Connection.hpp"
 
+#ifdef CONNECTION_USE_EPOLL
+#include <sys/epoll.h>
+#endif
+
+#ifdef CONNECTION_USE_IO_URING
+#include <linux/io_uring.h>
+#include <sys/syscall.h>
+#include <sys/mman.h>
+#include <poll.h>
+#endif
+
 //------------------------------------------------------
 
 #include <iostream>
 #include <cmath>
 #include <algorithm>
+#include <iterator>
 #include <cassert>
 #include <cstring>
+#include <cerrno>
+#include <system_error>
 
 //NOTE: much of the sockets code herein is based on http-tweak's single-header http server
 // see: https://github.com/ixchow/http-tweak
 
 //Also, some help and examples for getaddrinfo from: https://beej.us/guide/bgnet/html/multi/syscalls.html
 
+static void udp_send_bye(Poller *poller, Socket socket, UdpPeer const &peer);
 
 void Connection::close() {
 	if (socket != InvalidSocket) {
-		::closesocket(socket);
+		if (udp) udp_send_bye(poller, socket, *udp);
+		if (!udp || !udp->shared_socket) {
+			::closesocket(socket);
+			if (poller && poller->udp_socket == socket) poller->udp_socket = InvalidSocket;
+		}
 		socket = InvalidSocket;
+		//(owner removes the connection from its list on the next poll)
+		if (poller) {
+			std::lock_guard< std::mutex > lock(poller->mutex);
+			poller->closed.emplace_back(this);
+		}
+	}
+}
+
+void Connection::queue_send() {
+	send_queued = true;
+	if (poller) {
+		std::lock_guard< std::mutex > lock(poller->mutex);
+		poller->send_queued.emplace_back(this);
+	}
+}
+
+void Connection::send_shared(SharedBytes const &bytes) {
+	assert(bytes);
+	if (bytes->empty()) return;
+	SharedSegment segment;
+	segment.before = send_buffer.size() - send_segments_before;
+	segment.bytes = bytes;
+	send_segments_before += segment.before;
+	send_shared_bytes += bytes->size();
+	send_segments.emplace_back(std::move(segment));
+	if (!send_queued) queue_send();
+}
+
+void Connection::send_droppable(void const *prefix, size_t prefix_size, SharedBytes const &bytes) {
+	assert(bytes);
+	assert(prefix_size <= MaxDroppablePrefix);
+	if (!udp) {
+		if (prefix_size == 0 && bytes->empty()) return;
+		//a droppable message that hasn't started going out yet is stale now:
+		// (only the newest one can be unsent -- anything older went out ahead of it -- so look back to that)
+		for (auto s = send_segments.rbegin(); s != send_segments.rend(); ++s) {
+			if (!s->droppable) continue;
+			if (s->offset == 0) {
+				size_t before = s->before;
+				send_shared_bytes -= s->size();
+				auto next = send_segments.erase(std::next(s).base());
+				//(whatever was queued just ahead of it now goes out ahead of the next segment, or at the end)
+				if (next != send_segments.end()) next->before += before;
+				else send_segments_before -= before;
+				if (poller) poller->droppable_superseded.fetch_add(1, std::memory_order_relaxed);
+			}
+			break;
+		}
+
+		SharedSegment segment;
+		segment.before = send_buffer.size() - send_segments_before;
+		segment.bytes = bytes;
+		segment.droppable = true;
+		segment.prefix_size = uint8_t(prefix_size);
+		if (prefix_size) std::memcpy(segment.prefix, prefix, prefix_size);
+		send_segments_before += segment.before;
+		send_shared_bytes += segment.size();
+		send_segments.emplace_back(std::move(segment));
+		if (!send_queued) queue_send();
+		return;
+	}
+	if (udp->droppable_queued) {
+		udp->droppable_superseded += 1;
+		if (poller) poller->droppable_superseded.fetch_add(1, std::memory_order_relaxed);
+	}
+	udp->droppable_prefix.assign(reinterpret_cast< uint8_t const * >(prefix), reinterpret_cast< uint8_t const * >(prefix) + prefix_size);
+	udp->droppable_bytes = bytes;
+	udp->droppable_queued = true;
+	if (!send_queued) queue_send();
+}
+
+size_t Connection::peek_send(Piece *pieces, size_t max_pieces) const {
+	size_t count = 0;
+	size_t at = 0; //position in send_buffer
+	for (auto const &segment : send_segments) {
+		if (segment.before) {
+			if (count == max_pieces) return count;
+			pieces[count++] = Piece{ send_buffer.data() + at, segment.before };
+			at += segment.before;
+		}
+		if (segment.offset < segment.prefix_size) {
+			if (count == max_pieces) return count;
+			pieces[count++] = Piece{ segment.prefix + segment.offset, size_t(segment.prefix_size - segment.offset) };
+		}
+		if (!segment.bytes->empty()) {
+			size_t offset = std::max(segment.offset, size_t(segment.prefix_size)) - segment.prefix_size;
+			if (count == max_pieces) return count;
+			pieces[count++] = Piece{ segment.bytes->data() + offset, segment.bytes->size() - offset };
+		}
+	}
+	if (at < send_buffer.size() && count < max_pieces) {
+		pieces[count++] = Piece{ send_buffer.data() + at, send_buffer.size() - at };
+	}
+	return count;
+}
+
+void Connection::consume_send(size_t count) {
+	assert(count <= send_pending());
+	bytes_sent += count;
+	while (count && !send_segments.empty()) {
+		SharedSegment &segment = send_segments.front();
+		size_t owned = std::min(count, segment.before);
+		send_buffer.consume(owned);
+		segment.before -= owned;
+		send_segments_before -= owned;
+		count -= owned;
+		if (segment.before) break; //(so count is zero)
+
+		size_t shared = std::min(count, segment.size() - segment.offset);
+		segment.offset += shared;
+		send_shared_bytes -= shared;
+		count -= shared;
+		if (segment.offset == segment.size()) send_segments.pop_front();
+	}
+	send_buffer.consume(count);
+}
+
+//---------------------------------
+//Socket I/O helpers used by both polling backends:
+
+//(for Poller::syscalls)
+static void count_syscall(Poller *poller, uint64_t count = 1) {
+	if (poller) poller->syscalls.fetch_add(count, std::memory_order_relaxed);
+}
+
+//read everything available on a connection (stopping once the socket would block);
+// returns false if the connection was closed (by the peer, an error, or the event callback):
+static bool read_connection(
+	char const *where,
+	Connection &c,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	const uint32_t BufferSize = 20000;
+	static thread_local char *buffer = new char[BufferSize];
+
+	//n.b. reads until the socket would block (rather than stopping at a short read) so that
+	// a close that arrives along with data isn't missed by edge-triggered polling.
+	while (true) {
+		ssize_t ret = recv(c.socket, buffer, BufferSize, MSG_DONTWAIT);
+		count_syscall(c.poller);
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			//~no problem~ but no data
+			return true;
+		} else if (ret < 0 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0 || ret > (ssize_t)BufferSize) {
+			//~problem~ so remove connection
+			if (ret == 0) {
+				std::cerr << "[" << where << "] port closed, disconnecting." << std::endl;
+			} else if (ret < 0) {
+				std::cerr << "[" << where << "] recv() returned error " << errno << "(" << strerror(errno) << "), disconnecting." << std::endl;
+			} else {
+				std::cerr << "[" << where << "] recv() returned strange number of bytes, disconnecting." << std::endl;
+			}
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+			return false;
+		} else { //ret > 0
+			c.recv_buffer.append(buffer, size_t(ret));
+			if (on_event) on_event(&c, Connection::OnRecv);
+			//callback may have dropped the connection:
+			if (c.socket == InvalidSocket) return false;
+		}
+	}
+}
+
+//send as much of a connection's pending data as the socket will take;
+// returns false if the connection was closed:
+static bool write_connection(
+	char const *where,
+	Connection &c,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	while (c.send_pending()) {
+		//pending data is split between send_buffer and shared segments; hand the socket several pieces at once:
+		const size_t MaxPieces = 16;
+		Connection::Piece pieces[MaxPieces];
+		size_t piece_count = c.peek_send(pieces, MaxPieces);
+		assert(piece_count > 0);
+
+		#ifdef _WIN32
+		//(one piece at a time on windows)
+		size_t size = pieces[0].size;
+		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(pieces[0].data), int(size), MSG_DONTWAIT);
+		#else
+		struct iovec iov[MaxPieces];
+		size_t size = 0;
+		for (size_t i = 0; i < piece_count; ++i) {
+			iov[i].iov_base = const_cast< uint8_t * >(pieces[i].data);
+			iov[i].iov_len = pieces[i].size;
+			size += pieces[i].size;
+		}
+		struct msghdr msg;
+		memset(&msg, 0, sizeof(msg));
+		msg.msg_iov = iov;
+		msg.msg_iovlen = piece_count;
+		#ifdef MSG_NOSIGNAL
+		ssize_t ret = sendmsg(c.socket, &msg, MSG_DONTWAIT | MSG_NOSIGNAL);
+		#else
+		ssize_t ret = sendmsg(c.socket, &msg, MSG_DONTWAIT);
+		#endif
+		#endif 
+		count_syscall(c.poller);
+		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
+			//~no problem~, but don't keep trying
+			return true;
+		} else if (ret < 0 && errno == EINTR) {
+			continue;
+		} else if (ret <= 0 || ret > (ssize_t)size) {
+			if (ret < 0) {
+				std::cerr << "[" << where << "] send() returned error " << errno << ", disconnecting." << std::endl;
+			} else { assert(ret == 0 || ret > (ssize_t)size);
+				std::cerr << "[" << where << "] send() returned strange number of bytes [" << ret << " of " << size << "], disconnecting." << std::endl;
+			}
+			c.close();
+			if (on_event) on_event(&c, Connection::OnClose);
+			return false;
+		} else { //ret seems reasonable
+			c.consume_send(size_t(ret));
+		}
 	}
+	return true;
 }
 
 //---------------------------------
-//Polling helper used by both server and client:
-void poll_connections(
+//Bookkeeping helpers used by both polling backends:
+
+//add a connection for a newly accepted socket:
+static Connection &add_connection(std::list< Connection > &connections, Poller &poller, Socket socket) {
+	connections.emplace_back();
+	Connection &c = connections.back();
+	c.socket = socket;
+	c.poller = &poller;
+	c.self = std::prev(connections.end());
+	return c;
+}
+
+#ifdef CONNECTION_USE_EPOLL
+//sockets are registered with epoll edge-triggered for reading once (when opened), and for writing only
+// while they have something to send; each registration carries its Connection * (nullptr for the listen socket):
+static void epoll_register(char const *where, Poller &poller, Socket socket, Connection *c) {
+	struct epoll_event ev;
+	memset(&ev, 0, sizeof(ev));
+	ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET;
+	ev.data.ptr = c;
+	count_syscall(&poller);
+	if (epoll_ctl(poller.epoll_fd, EPOLL_CTL_ADD, socket, &ev) != 0) {
+		std::cerr << "[" << where << "] epoll_ctl(ADD) failed: " << strerror(errno) << std::endl;
+	}
+}
+
+//returns -1 (and the caller falls back to select()) if epoll isn't available:
+static int epoll_create_or_warn(char const *where) {
+	int epoll_fd = epoll_create1(EPOLL_CLOEXEC);
+	if (epoll_fd < 0) {
+		std::cerr << "[" << where << "] epoll_create1 failed (" << strerror(errno) << "); falling back to select()." << std::endl;
+	}
+	return epoll_fd;
+}
+#endif //CONNECTION_USE_EPOLL
+
+//(un)watch a connection's socket for writability, if that changes anything:
+static void set_write_interest(char const *where, Poller &poller, Connection &c, bool want) {
+	if (c.write_interest == want || c.socket == InvalidSocket) return;
+	#ifdef CONNECTION_USE_EPOLL
+	if (poller.epoll_fd >= 0) {
+		struct epoll_event ev;
+		memset(&ev, 0, sizeof(ev));
+		ev.events = EPOLLIN | EPOLLRDHUP | EPOLLET | (want ? EPOLLOUT : 0);
+		ev.data.ptr = &c;
+		count_syscall(&poller);
+		if (epoll_ctl(poller.epoll_fd, EPOLL_CTL_MOD, c.socket, &ev) != 0) {
+			std::cerr << "[" << where << "] epoll_ctl(MOD) failed: " << strerror(errno) << std::endl;
+			return;
+		}
+	}
+	#endif
+	c.write_interest = want;
+}
+
+//try to send anything queued since the last poll right away;
+// only sockets that can't take all of it need to wait for writability:
+static void flush_send_queue(
 	char const *where,
+	Poller &poller,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	static thread_local std::vector< Connection * > queued;
+	queued.clear();
+	{
+		std::lock_guard< std::mutex > lock(poller.mutex);
+		std::swap(queued, poller.send_queued);
+	}
+	for (Connection *c : queued) {
+		c->send_queued = false;
+		if (c->socket == InvalidSocket || c->write_interest || c->send_pending() == 0) continue;
+		if (!write_connection(where, *c, on_event)) continue;
+		set_write_interest(where, poller, *c, c->send_pending() != 0);
+	}
+}
+
+//remove connections closed since the last poll from the connections list:
+static void reap_closed(std::list< Connection > &connections, Poller &poller) {
+	std::lock_guard< std::mutex > lock(poller.mutex);
+	for (Connection *c : poller.closed) {
+		if (c->send_queued) {
+			auto f = std::find(poller.send_queued.begin(), poller.send_queued.end(), c);
+			if (f != poller.send_queued.end()) {
+				*f = poller.send_queued.back();
+				poller.send_queued.pop_back();
+			}
+		}
+		if (c->udp) {
+			auto f = poller.udp_peers.find(c->udp->address);
+			if (f != poller.udp_peers.end() && f->second == c) poller.udp_peers.erase(f);
+		}
+		connections.erase(c->self);
+	}
+	poller.closed.clear();
+}
+
+//a wake() has been seen; re-arm it and empty the socket pair:
+static void drain_wake(Poller &poller) {
+	//(cleared first, so a wake() racing with this writes again rather than being lost)
+	poller.wake_pending.store(false);
+	char buffer[64];
+	do {
+		count_syscall(&poller);
+	} while (recv(poller.wake_recv, buffer, sizeof(buffer), MSG_DONTWAIT) > 0);
+}
+
+#ifdef CONNECTION_USE_EPOLL
+//---------------------------------
+//epoll backend:
+static void epoll_poll_connections(
+	char const *where,
+	Poller &poller,
 	std::list< Connection > &connections,
 	std::function< void(Connection *, Connection::Event event) > const &on_event,
 	double timeout,
 	Socket listen_socket = InvalidSocket) {
 
+	flush_send_queue(where, poller, on_event);
+
+	const int MaxEvents = 256;
+	static thread_local struct epoll_event events[MaxEvents];
+
+	//wait (until timeout) for sockets' data to become available:
+	// (rounded up to whole milliseconds so short waits don't turn into a spin)
+	int timeout_ms = int(std::ceil(std::max(0.0, timeout) * 1000.0));
+	int count = epoll_wait(poller.epoll_fd, events, MaxEvents, timeout_ms);
+	count_syscall(&poller);
+	if (count < 0) {
+		if (errno != EINTR) {
+			std::cerr << "[" << where << "] epoll_wait returned an error: " << strerror(errno) << std::endl;
+		}
+		return;
+	}
+
+	for (int i = 0; i < count; ++i) {
+		if (events[i].data.ptr == &poller) {
+			drain_wake(poller);
+			continue;
+		}
+
+		Connection *c = reinterpret_cast< Connection * >(events[i].data.ptr);
+
+		if (c == nullptr) {
+			//add new connections as needed:
+			// (listen socket is non-blocking, so accept until there are none left)
+			assert(listen_socket != InvalidSocket);
+			while (true) {
+				Socket got = accept(listen_socket, NULL, NULL);
+				count_syscall(&poller);
+				if (got == InvalidSocket) break; //(EAGAIN, or oh well.)
+				Connection &added = add_connection(connections, poller, got);
+				epoll_register(where, poller, got, &added);
+				std::cerr << "[" << where << "] client connected on " << added.socket << "." << std::endl; //INFO
+				if (on_event) on_event(&added, Connection::OnOpen);
+			}
+			continue;
+		}
+
+		//(connection may have been closed by a callback earlier in this batch)
+		if (c->socket == InvalidSocket) continue;
+
+		//errors / hangups show up as reads that fail or return zero bytes:
+		if (events[i].events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR)) {
+			if (!read_connection(where, *c, on_event)) continue;
+		}
+
+		//socket has room for more data:
+		if (c->write_interest && (events[i].events & EPOLLOUT)) {
+			if (!write_connection(where, *c, on_event)) continue;
+			set_write_interest(where, poller, *c, c->send_pending() != 0);
+		}
+	}
+}
+#endif //CONNECTION_USE_EPOLL
+
+//---------------------------------
+//select() backend:
+static void poll_connections(
+	char const *where,
+	Poller &poller,
+	std::list< Connection > &connections,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	double timeout,
+	Socket listen_socket = InvalidSocket) {
+
+	flush_send_queue(where, poller, on_event);
+
 	fd_set read_fds, write_fds;
 	FD_ZERO(&read_fds);
 	FD_ZERO(&write_fds);
@@ -72,13 +494,17 @@ void poll_connections(
 		max = std::max(max, int(listen_socket));
 		FD_SET(listen_socket, &read_fds);
 	}
+	if (poller.wake_recv != InvalidSocket) {
+		max = std::max(max, int(poller.wake_recv));
+		FD_SET(poller.wake_recv, &read_fds);
+	}
 
 	//add each connection's socket to read (and possibly write) sets:
-	for (auto c : connections) {
+	for (auto const &c : connections) {
 		if (c.socket != InvalidSocket) {
 			max = std::max(max, int(c.socket));
 			FD_SET(c.socket, &read_fds);
-			if (!c.send_buffer.empty()) {
+			if (c.write_interest) {
 				FD_SET(c.socket, &write_fds);
 			}
 		}
@@ -90,6 +516,7 @@ void poll_connections(
 		tv.tv_usec = std::lround((timeout - std::floor(timeout)) * 1e6);
 		//NOTE: on windows nfds is ignored -- https://msdn.microsoft.com/en-us/library/windows/desktop/ms740141(v=vs.85).aspx
 		int ret = select(max + 1, &read_fds, &write_fds, NULL, &tv);
+		count_syscall(&poller);
 
 		if (ret < 0) {
 			std::cerr << "[" << where << "] Select returned an error; will attempt to read/write anyway." << std::endl;
@@ -99,9 +526,12 @@ void poll_connections(
 		}
 	}
 
+	if (poller.wake_recv != InvalidSocket && FD_ISSET(poller.wake_recv, &read_fds)) drain_wake(poller);
+
 	//add new connections as needed:
 	if (listen_socket != InvalidSocket && FD_ISSET(listen_socket, &read_fds)) {
 		Socket got = accept(listen_socket, NULL, NULL);
+		count_syscall(&poller);
 		if (got == InvalidSocket) {
 			//oh well.
 		} else {
@@ -111,80 +541,986 @@ void poll_connections(
 			#else
 			{
 			#endif
-				connections.emplace_back();
-				connections.back().socket = got;
-				std::cerr << "[" << where << "] client connected on " << connections.back().socket << "." << std::endl; //INFO
-				if (on_event) on_event(&connections.back(), Connection::OnOpen);
+				Connection &added = add_connection(connections, poller, got);
+				std::cerr << "[" << where << "] client connected on " << added.socket << "." << std::endl; //INFO
+				if (on_event) on_event(&added, Connection::OnOpen);
 			}
 		}
 	}
 
-	const uint32_t BufferSize = 20000;
-	static thread_local char *buffer = new char[BufferSize];
-
 	//process requests:
 	for (auto &c : connections) {
 		//only read from valid sockets marked readable:
 		if (c.socket == InvalidSocket || !FD_ISSET(c.socket, &read_fds)) continue;
+		read_connection(where, c, on_event);
+	}
 
-		while (true) { //read until more data left to read
-			ssize_t ret = recv(c.socket, buffer, BufferSize, MSG_DONTWAIT);
-			if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-				//~no problem~ but no data
-				break;
-			} else if (ret <= 0 || ret > (ssize_t)BufferSize) {
-				//~problem~ so remove connection
-				if (ret == 0) {
-					std::cerr << "[" << where << "] port closed, disconnecting." << std::endl;
-				} else if (ret < 0) {
-					std::cerr << "[" << where << "] recv() returned error " << errno << "(" << strerror(errno) << "), disconnecting." << std::endl;
-				} else {
-					std::cerr << "[" << where << "] recv() returned strange number of bytes, disconnecting." << std::endl;
+	//process responses:
+	for (auto &c : connections) {
+		//don't bother with connections unless they are valid, waiting to send, and are marked writable:
+		if (c.socket == InvalidSocket || !c.write_interest || !FD_ISSET(c.socket, &write_fds)) continue;
+		if (!write_connection(where, c, on_event)) continue;
+		set_write_interest(where, poller, c, c.send_pending() != 0);
+	}
+}
+
+//---------------------------------
+//UDP transport:
+// every datagram starts with a kind byte:
+//  'H' hello (client -> server, until answered)   'W' welcome (server -> client)
+//  'R' reliable fragment: [seq:4][bytes]          'A' ack: [next expected seq:4][bits:4] (bit i => seq next+1+i arrived)
+//  'U' droppable fragment: [message seq:4][index:2][count:2][bytes]
+//  'K' keepalive                                  'B' bye (connection closed)
+// reliable bytes are handed to recv_buffer a whole message at a time (so they never interleave with
+// droppable messages), which relies on every message being framed as [type:1][size:3][payload].
+
+enum UdpKind : uint8_t {
+	UdpHello = 'H',
+	UdpWelcome = 'W',
+	UdpReliable = 'R',
+	UdpAck = 'A',
+	UdpDroppable = 'U',
+	UdpKeepalive = 'K',
+	UdpBye = 'B',
+};
+
+static const size_t UdpMaxPayload = 1200; //data bytes per datagram (keeps datagrams under common MTUs)
+static const size_t UdpMaxInFlight = 256; //reliable fragments sent but not yet acked
+static const uint32_t UdpMaxEarly = 1024; //how far past next_recv_seq reliable fragments are kept
+static const uint32_t UdpMaxFragments = 4096; //largest droppable message, in fragments
+static const double UdpKeepaliveInterval = 1.0; //seconds of silence before sending a keepalive
+static const double UdpTimeout = 10.0; //seconds of silence from a peer before dropping it
+
+static double seconds_between(UdpPeer::Time a, UdpPeer::Time b) {
+	return std::chrono::duration< double >(b - a).count();
+}
+
+static UdpPeer::Time after(UdpPeer::Time t, double seconds) {
+	return t + std::chrono::duration_cast< UdpPeer::Time::duration >(std::chrono::duration< double >(seconds));
+}
+
+static void set_nonblocking(Socket s) {
+	#ifdef _WIN32
+	unsigned long one = 1;
+	int ret = ioctlsocket(s, FIONBIO, &one);
+	#else
+	int flags = fcntl(s, F_GETFL, 0);
+	int ret = (flags < 0 ? -1 : fcntl(s, F_SETFL, flags | O_NONBLOCK));
+	#endif
+	if (ret != 0) throw std::system_error(errno, std::system_category(), "failed to make socket non-blocking");
+}
+
+static void put_u32(std::vector< uint8_t > &out, uint32_t val) {
+	uint8_t bytes[4] = { uint8_t(val), uint8_t(val >> 8), uint8_t(val >> 16), uint8_t(val >> 24) };
+	out.insert(out.end(), bytes, bytes + 4);
+}
+
+static uint32_t get_u32(uint8_t const *data) {
+	return uint32_t(data[0]) | (uint32_t(data[1]) << 8) | (uint32_t(data[2]) << 16) | (uint32_t(data[3]) << 24);
+}
+
+//send one datagram (or pretend to, if loss injection drops it); errors are treated like loss:
+static void udp_send_datagram(Poller *poller, Socket socket, std::string const &address, void const *data, size_t size) {
+	if (poller) {
+		poller->datagrams_sent += 1;
+		if (poller->drop_rate > 0.0 && std::uniform_real_distribution< double >(0.0, 1.0)(poller->drop_rng) < poller->drop_rate) {
+			poller->datagrams_dropped += 1;
+			return;
+		}
+	}
+	count_syscall(poller);
+	sendto(socket, reinterpret_cast< char const * >(data), int(size), MSG_DONTWAIT,
+		reinterpret_cast< struct sockaddr const * >(address.data()), socklen_t(address.size()));
+}
+
+static void udp_send_kind(Poller *poller, Socket socket, UdpPeer &peer, UdpKind kind) {
+	uint8_t byte = kind;
+	udp_send_datagram(poller, socket, peer.address, &byte, 1);
+	peer.last_send = std::chrono::steady_clock::now();
+}
+
+static void udp_send_bye(Poller *poller, Socket socket, UdpPeer const &peer) {
+	uint8_t byte = UdpBye;
+	udp_send_datagram(poller, socket, peer.address, &byte, 1);
+}
+
+//time to wait for an ack before resending:
+static double udp_resend_delay(UdpPeer const &peer, uint32_t sends) {
+	double rto = std::min(1.0, std::max(0.03, 2.0 * peer.rtt));
+	return rto * std::min< uint32_t >(sends, 8); //(backs off while acks aren't coming back)
+}
+
+static void udp_send_fragment(Poller &poller, Connection &c, UdpPeer::Fragment &fragment, UdpPeer::Time now) {
+	udp_send_datagram(&poller, c.socket, c.udp->address, fragment.bytes.data(), fragment.bytes.size());
+	fragment.sent_at = now;
+	fragment.sends += 1;
+	c.udp->last_send = now;
+	poller.udp_next_timer = std::min(poller.udp_next_timer, after(now, udp_resend_delay(*c.udp, fragment.sends)));
+}
+
+//send what a connection has queued: reliable bytes (as far as the window allows) and the newest droppable message:
+static void udp_flush(Poller &poller, Connection &c, UdpPeer::Time now) {
+	UdpPeer &peer = *c.udp;
+
+	while (c.send_pending() && peer.in_flight.size() < UdpMaxInFlight) {
+		peer.in_flight.emplace_back();
+		UdpPeer::Fragment &fragment = peer.in_flight.back();
+		fragment.seq = peer.next_send_seq++;
+		fragment.bytes.reserve(5 + UdpMaxPayload);
+		fragment.bytes.emplace_back(UdpReliable);
+		put_u32(fragment.bytes, fragment.seq);
+
+		const size_t MaxPieces = 16;
+		Connection::Piece pieces[MaxPieces];
+		size_t piece_count = c.peek_send(pieces, MaxPieces);
+		size_t taken = 0;
+		for (size_t i = 0; i < piece_count && taken < UdpMaxPayload; ++i) {
+			size_t n = std::min(pieces[i].size, UdpMaxPayload - taken);
+			fragment.bytes.insert(fragment.bytes.end(), pieces[i].data, pieces[i].data + n);
+			taken += n;
+		}
+		c.consume_send(taken);
+
+		udp_send_fragment(poller, c, fragment, now);
+	}
+
+	if (peer.droppable_queued) {
+		peer.droppable_queued = false;
+		std::vector< uint8_t > const &prefix = peer.droppable_prefix;
+		std::vector< uint8_t > const &bytes = *peer.droppable_bytes;
+		size_t size = prefix.size() + bytes.size();
+		size_t count = (size + UdpMaxPayload - 1) / UdpMaxPayload;
+		if (count > UdpMaxFragments) {
+			std::cerr << "[udp] droppable message of " << size << " bytes is too large to send; skipping it." << std::endl;
+		} else if (count > 0) {
+			uint32_t seq = peer.next_droppable_seq++;
+			std::vector< uint8_t > datagram;
+			datagram.reserve(9 + UdpMaxPayload);
+			for (size_t i = 0; i < count; ++i) {
+				datagram.clear();
+				datagram.emplace_back(UdpDroppable);
+				put_u32(datagram, seq);
+				datagram.emplace_back(uint8_t(i));
+				datagram.emplace_back(uint8_t(i >> 8));
+				datagram.emplace_back(uint8_t(count));
+				datagram.emplace_back(uint8_t(count >> 8));
+				//this fragment's share of prefix + bytes:
+				size_t begin = i * UdpMaxPayload;
+				size_t end = std::min(size, begin + UdpMaxPayload);
+				if (begin < prefix.size()) {
+					datagram.insert(datagram.end(), prefix.begin() + begin, prefix.begin() + std::min(end, prefix.size()));
 				}
-				c.close();
-				if (on_event) on_event(&c, Connection::OnClose);
-				break;
-			} else { //ret > 0
-				c.recv_buffer.insert(c.recv_buffer.end(), buffer, buffer + ret);
-				if (on_event) on_event(&c, Connection::OnRecv);
-				if (ret < BufferSize) break; //ran out of data before buffer: no more data left to read
+				if (end > prefix.size()) {
+					size_t from = std::max(begin, prefix.size()) - prefix.size();
+					datagram.insert(datagram.end(), bytes.begin() + from, bytes.begin() + (end - prefix.size()));
+				}
+				udp_send_datagram(&poller, c.socket, peer.address, datagram.data(), datagram.size());
 			}
+			peer.last_send = now;
 		}
+		peer.droppable_prefix.clear();
+		peer.droppable_bytes.reset();
 	}
+}
 
-	//process responses:
+//resend unacked fragments, send keepalives, and drop peers that have gone quiet:
+static void udp_check_timers(
+	char const *where,
+	Poller &poller,
+	std::list< Connection > &connections,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	UdpPeer::Time now) {
+
+	if (now < poller.udp_next_timer) return;
+
+	UdpPeer::Time next = after(now, UdpKeepaliveInterval);
 	for (auto &c : connections) {
-		//don't bother with connections unless they are valid, have something to send, and are marked writable:
-		if (c.socket == InvalidSocket || c.send_buffer.empty() || !FD_ISSET(c.socket, &write_fds)) continue;
-		
-		#ifdef _WIN32
-		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.data()), int(c.send_buffer.size()), MSG_DONTWAIT);
-		#else
-		ssize_t ret = send(c.socket, reinterpret_cast< char const * >(c.send_buffer.data()), c.send_buffer.size(), MSG_DONTWAIT);
-		#endif 
-		if (ret < 0 && (errno == EAGAIN || errno == EWOULDBLOCK)) {
-			//~no problem~, but don't keep trying
-			break;
-		} else if (ret <= 0 || ret > (ssize_t)c.send_buffer.size()) {
-			if (ret < 0) {
-				std::cerr << "[" << where << "] send() returned error " << errno << ", disconnecting." << std::endl;
-			} else { assert(ret == 0 || ret > (ssize_t)c.send_buffer.size());
-				std::cerr << "[" << where << "] send() returned strange number of bytes [" << ret << " of " << c.send_buffer.size() << "], disconnecting." << std::endl;
-			}
+		if (c.socket == InvalidSocket || !c.udp) continue;
+		UdpPeer &peer = *c.udp;
+
+		if (seconds_between(peer.last_recv, now) > UdpTimeout) {
+			std::cerr << "[" << where << "] nothing heard from peer for " << UdpTimeout << " seconds, disconnecting." << std::endl;
 			c.close();
 			if (on_event) on_event(&c, Connection::OnClose);
-		} else { //ret seems reasonable
-			c.send_buffer.erase(c.send_buffer.begin(), c.send_buffer.begin() + ret);
+			continue;
+		}
+
+		for (auto &fragment : peer.in_flight) {
+			if (fragment.acked) continue;
+			UdpPeer::Time due = after(fragment.sent_at, udp_resend_delay(peer, fragment.sends));
+			if (now >= due) {
+				udp_send_fragment(poller, c, fragment, now);
+				due = after(now, udp_resend_delay(peer, fragment.sends));
+			}
+			next = std::min(next, due);
+		}
+
+		if (seconds_between(peer.last_send, now) >= UdpKeepaliveInterval) udp_send_kind(&poller, c.socket, peer, UdpKeepalive);
+		next = std::min(next, after(peer.last_send, UdpKeepaliveInterval));
+		next = std::min(next, after(peer.last_recv, UdpTimeout));
+	}
+	poller.udp_next_timer = next;
+}
+
+//handle one datagram from a known peer:
+static void udp_handle_datagram(
+	char const *where,
+	Poller &poller,
+	Connection &c,
+	uint8_t const *data, size_t size,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	UdpPeer &peer = *c.udp;
+	peer.last_recv = std::chrono::steady_clock::now();
+	uint8_t kind = data[0];
+
+	if (kind == UdpHello) {
+		//(our welcome was lost)
+		udp_send_kind(&poller, c.socket, peer, UdpWelcome);
+
+	} else if (kind == UdpReliable) {
+		if (size <= 5) return;
+		uint32_t seq = get_u32(data + 1);
+		if (!peer.ack_queued) {
+			peer.ack_queued = true;
+			poller.udp_ack_queued.emplace_back(&c);
 		}
+		//(seqs before next_recv_seq are duplicates and wrap around to large offsets)
+		if (seq - peer.next_recv_seq >= UdpMaxEarly) return;
+		if (seq != peer.next_recv_seq) {
+			peer.early.emplace(seq, std::vector< uint8_t >(data + 5, data + size));
+			return;
+		}
+		peer.reliable_recv.append(data + 5, size - 5);
+		peer.next_recv_seq += 1;
+		for (auto f = peer.early.find(peer.next_recv_seq); f != peer.early.end(); f = peer.early.find(peer.next_recv_seq)) {
+			peer.reliable_recv.append(f->second.data(), f->second.size());
+			peer.early.erase(f);
+			peer.next_recv_seq += 1;
+		}
+
+		//hand over whole messages:
+		bool delivered = false;
+		while (peer.reliable_recv.size() >= 4) {
+			size_t message_size = 4 + ((size_t(peer.reliable_recv[3]) << 16) | (size_t(peer.reliable_recv[2]) << 8) | size_t(peer.reliable_recv[1]));
+			if (peer.reliable_recv.size() < message_size) break;
+			c.recv_buffer.append(peer.reliable_recv.data(), message_size);
+			peer.reliable_recv.consume(message_size);
+			delivered = true;
+		}
+		if (delivered && on_event) on_event(&c, Connection::OnRecv);
+
+	} else if (kind == UdpAck) {
+		if (size < 9) return;
+		uint32_t next = get_u32(data + 1);
+		uint32_t bits = get_u32(data + 5);
+		auto now = peer.last_recv;
+		for (auto &fragment : peer.in_flight) {
+			if (fragment.acked) continue;
+			uint32_t ahead = fragment.seq - next;
+			bool acked = (int32_t(ahead) < 0) || (ahead >= 1 && ahead <= 32 && ((bits >> (ahead - 1)) & 1));
+			if (!acked) continue;
+			fragment.acked = true;
+			fragment.bytes = std::vector< uint8_t >();
+			//(only fragments sent once give unambiguous round-trip samples)
+			if (fragment.sends == 1) peer.rtt = 0.875 * peer.rtt + 0.125 * seconds_between(fragment.sent_at, now);
+		}
+		while (!peer.in_flight.empty() && peer.in_flight.front().acked) {
+			peer.in_flight.pop_front();
+		}
+		//window may have room for more now:
+		if (c.send_pending() && !c.send_queued) c.queue_send();
+
+	} else if (kind == UdpDroppable) {
+		if (size <= 9) return;
+		uint32_t seq = get_u32(data + 1);
+		uint32_t index = uint32_t(data[5]) | (uint32_t(data[6]) << 8);
+		uint32_t count = uint32_t(data[7]) | (uint32_t(data[8]) << 8);
+		if (count == 0 || index >= count || count > UdpMaxFragments) return;
+		if (int32_t(seq - peer.delivered_seq) <= 0) return; //superseded by a message already delivered
+
+		if (seq != peer.partial_seq) {
+			if (peer.partial_seq != 0 && int32_t(seq - peer.partial_seq) < 0) return; //older than the one being assembled
+			peer.partial_seq = seq;
+			peer.partial.assign(count, std::vector< uint8_t >());
+			peer.partial_missing = count;
+		}
+		if (count != peer.partial.size() || !peer.partial[index].empty()) return;
+		peer.partial[index].assign(data + 9, data + size);
+		peer.partial_missing -= 1;
+		if (peer.partial_missing != 0) return;
+
+		for (auto const &piece : peer.partial) {
+			c.recv_buffer.append(piece.data(), piece.size());
+		}
+		peer.droppable_lost += seq - peer.delivered_seq - 1;
+		peer.delivered_seq = seq;
+		peer.partial_seq = 0;
+		peer.partial.clear();
+		if (on_event) on_event(&c, Connection::OnRecv);
+
+	} else if (kind == UdpBye) {
+		std::cerr << "[" << where << "] peer said goodbye, disconnecting." << std::endl;
+		c.close();
+		if (on_event) on_event(&c, Connection::OnClose);
 	}
+	//(UdpWelcome and UdpKeepalive just count as hearing from the peer)
+}
+
+//read every waiting datagram:
+static void udp_receive(
+	char const *where,
+	Poller &poller,
+	std::list< Connection > &connections,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	bool accept_new) {
+
+	const uint32_t BufferSize = 65536;
+	static thread_local std::vector< uint8_t > storage(BufferSize); //(freed when the thread exits)
+	uint8_t *buffer = storage.data();
 
-		
+	while (poller.udp_socket != InvalidSocket) {
+		struct sockaddr_storage from;
+		socklen_t from_len = sizeof(from);
+		ssize_t ret = recvfrom(poller.udp_socket, reinterpret_cast< char * >(buffer), BufferSize, MSG_DONTWAIT, reinterpret_cast< struct sockaddr * >(&from), &from_len);
+		count_syscall(&poller);
+		if (ret < 0 && errno == EINTR) continue;
+		if (ret < 0) break; //(EAGAIN, or an error that reads can't fix)
+		if (ret == 0) continue;
+		std::string address(reinterpret_cast< char const * >(&from), from_len);
+
+		Connection *c = nullptr;
+		if (accept_new) {
+			auto f = poller.udp_peers.find(address);
+			if (f != poller.udp_peers.end()) c = f->second;
+		} else if (!connections.empty() && connections.front().udp && connections.front().udp->address == address) {
+			c = &connections.front();
+		}
+
+		if (c == nullptr) {
+			//new client:
+			if (!accept_new || buffer[0] != UdpHello) continue;
+			Connection &added = add_connection(connections, poller, poller.udp_socket);
+			added.udp = std::make_unique< UdpPeer >();
+			added.udp->address = address;
+			added.udp->shared_socket = true;
+			added.udp->last_recv = std::chrono::steady_clock::now();
+			poller.udp_peers.emplace(address, &added);
+			udp_send_kind(&poller, added.socket, *added.udp, UdpWelcome);
+			std::cerr << "[" << where << "] client connected over udp (" << poller.udp_peers.size() << " peers)." << std::endl; //INFO
+			if (on_event) on_event(&added, Connection::OnOpen);
+			continue;
+		}
+		if (c->socket == InvalidSocket) continue; //(closed, not yet reaped)
+
+		udp_handle_datagram(where, poller, *c, buffer, size_t(ret), on_event);
+	}
 }
 
+//ack the reliable fragments received this poll (one ack per connection):
+static void udp_send_acks(Poller &poller) {
+	for (Connection *c : poller.udp_ack_queued) {
+		c->udp->ack_queued = false;
+		if (c->socket == InvalidSocket) continue;
+		UdpPeer &peer = *c->udp;
+		uint32_t bits = 0;
+		for (auto const &[seq, bytes] : peer.early) {
+			uint32_t ahead = seq - peer.next_recv_seq;
+			if (ahead >= 1 && ahead <= 32) bits |= (1u << (ahead - 1));
+		}
+		std::vector< uint8_t > datagram;
+		datagram.emplace_back(UdpAck);
+		put_u32(datagram, peer.next_recv_seq);
+		put_u32(datagram, bits);
+		udp_send_datagram(&poller, c->socket, peer.address, datagram.data(), datagram.size());
+		peer.last_send = std::chrono::steady_clock::now();
+	}
+	poller.udp_ack_queued.clear();
+}
+
+static void udp_poll_connections(
+	char const *where,
+	Poller &poller,
+	std::list< Connection > &connections,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	double timeout,
+	bool accept_new) {
+
+	auto now = std::chrono::steady_clock::now();
+
+	{ //send anything queued since the last poll:
+		static thread_local std::vector< Connection * > queued;
+		queued.clear();
+		{
+			std::lock_guard< std::mutex > lock(poller.mutex);
+			std::swap(queued, poller.send_queued);
+		}
+		for (Connection *c : queued) {
+			c->send_queued = false;
+			if (c->socket == InvalidSocket || !c->udp) continue;
+			udp_flush(poller, *c, now);
+		}
+	}
+
+	udp_check_timers(where, poller, connections, on_event, now);
+
+	if (poller.udp_socket == InvalidSocket) return;
+
+	{ //wait (until timeout, or the next resend/keepalive) for datagrams:
+		// (may return before timeout; callers poll in a loop anyway)
+		double wait = std::max(0.0, std::min(timeout, seconds_between(now, poller.udp_next_timer)));
+		fd_set read_fds;
+		FD_ZERO(&read_fds);
+		FD_SET(poller.udp_socket, &read_fds);
+		int max = int(poller.udp_socket);
+		if (poller.wake_recv != InvalidSocket) {
+			max = std::max(max, int(poller.wake_recv));
+			FD_SET(poller.wake_recv, &read_fds);
+		}
+		struct timeval tv;
+		tv.tv_sec = std::lround(std::floor(wait));
+		tv.tv_usec = std::lround((wait - std::floor(wait)) * 1e6);
+		int ret = select(max + 1, &read_fds, NULL, NULL, &tv);
+		count_syscall(&poller);
+		if (ret > 0 && poller.wake_recv != InvalidSocket && FD_ISSET(poller.wake_recv, &read_fds)) drain_wake(poller);
+		if (ret > 0 && FD_ISSET(poller.udp_socket, &read_fds)) udp_receive(where, poller, connections, on_event, accept_new);
+	}
+
+	udp_send_acks(poller);
+	udp_check_timers(where, poller, connections, on_event, std::chrono::steady_clock::now());
+}
+
+#ifdef CONNECTION_USE_IO_URING
 //---------------------------------
+//io_uring backend (TCP servers; see PollBackend):
+// - the listen socket has a multishot accept, and each connection a multishot receive that takes
+//   buffers from a ring registered with the kernel, so data arrives without a call per socket;
+// - pending sends are copied into slots of a send arena and added to the submission queue; they all
+//   go to the kernel in the same io_uring_enter() that waits for completions;
+// - a closed connection's requests are cancelled, and it is only freed once they have all finished.
+// Requests carry the Connection * they're for (nullptr for the listen socket, the wake socket,
+// cancellations, and the setup test) with the kind of request in the low bits, as their user_data.
+
+static const uint32_t UringEntries = 4096; //submission queue entries (the completion queue gets twice as many)
+static const uint32_t UringRecvBuffers = 1024; //(must be a power of two)
+static const uint32_t UringRecvBufferSize = 4096;
+static const uint32_t UringSendSlots = 2048;
+static const uint32_t UringSendSlotSize = 4096;
+static const uint16_t UringRecvGroup = 0; //(buffer group id of the receive ring)
+
+enum UringKind : uint64_t {
+	UringRecv = 1,
+	UringSend = 2,
+	UringAccept = 3,
+	UringWake = 4,
+	UringCancel = 5,
+	UringKindMask = 7, //(Connections are at least 8-byte aligned, so their low bits are free)
+};
+
+static uint64_t uring_data(Connection const *c, UringKind kind) {
+	return uint64_t(reinterpret_cast< uintptr_t >(c)) | kind;
+}
+
+static uint8_t *uring_map(size_t size) {
+	void *ptr = mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+	return (ptr == MAP_FAILED ? nullptr : reinterpret_cast< uint8_t * >(ptr));
+}
+
+IoUring::~IoUring() {
+	if (fd >= 0) ::close(fd);
+	if (rings) munmap(rings, rings_size);
+	if (sqes) munmap(sqes, sqes_size);
+	if (recv_ring) munmap(recv_ring, recv_ring_size);
+	if (recv_buffers) munmap(recv_buffers, size_t(UringRecvBuffers) * UringRecvBufferSize);
+	if (send_arena) munmap(send_arena, size_t(UringSendSlots) * UringSendSlotSize);
+}
+
+//submit everything added since the last call and wait (up to timeout) for at least 'wait_for' completions:
+static void uring_enter(char const *where, Poller &poller, uint32_t wait_for, double timeout) {
+	IoUring &uring = *poller.uring;
+	timeout = std::max(0.0, timeout);
+	struct __kernel_timespec ts;
+	ts.tv_sec = int64_t(std::floor(timeout));
+	ts.tv_nsec = int64_t((timeout - std::floor(timeout)) * 1e9);
+	struct io_uring_getevents_arg arg;
+	memset(&arg, 0, sizeof(arg));
+	arg.ts = uint64_t(reinterpret_cast< uintptr_t >(&ts));
+	uint32_t flags = IORING_ENTER_EXT_ARG | (wait_for ? IORING_ENTER_GETEVENTS : 0);
+	long ret = syscall(__NR_io_uring_enter, uring.fd, uring.unsubmitted, wait_for, flags, &arg, sizeof(arg));
+	count_syscall(&poller);
+	//(whatever the kernel moved the head past has been taken)
+	uring.unsubmitted = *uring.sq_tail - __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE);
+	if (ret < 0 && errno != ETIME && errno != EINTR && errno != EAGAIN && errno != EBUSY) {
+		std::cerr << "[" << where << "] io_uring_enter failed: " << strerror(errno) << std::endl;
+	}
+}
+
+//next submission queue entry (cleared), or nullptr if the queue stays full even after submitting it:
+static struct io_uring_sqe *uring_get_sqe(char const *where, Poller &poller) {
+	IoUring &uring = *poller.uring;
+	uint32_t tail = *uring.sq_tail;
+	if (tail - __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE) >= uring.sq_entries) {
+		uring_enter(where, poller, 0, 0.0);
+		if (tail - __atomic_load_n(uring.sq_head, __ATOMIC_ACQUIRE) >= uring.sq_entries) {
+			std::cerr << "[" << where << "] io_uring submission queue full." << std::endl;
+			return nullptr;
+		}
+	}
+	struct io_uring_sqe *sqe = reinterpret_cast< struct io_uring_sqe * >(uring.sqes) + (tail & uring.sq_mask);
+	memset(sqe, 0, sizeof(*sqe));
+	//n.b. the entry is published before the caller fills it in; that's fine since the kernel only
+	// reads entries during io_uring_enter(), which is only ever called from this thread.
+	__atomic_store_n(uring.sq_tail, tail + 1, __ATOMIC_RELEASE);
+	uring.unsubmitted += 1;
+	return sqe;
+}
+
+//give a receive buffer back to the kernel:
+static void uring_recycle(IoUring &uring, uint16_t bid) {
+	struct io_uring_buf_ring *ring = reinterpret_cast< struct io_uring_buf_ring * >(uring.recv_ring);
+	//n.b. indexed by hand: some versions of the header declare 'bufs' in a way that puts it 8 bytes off in C++
+	// (the ring's tail overlays the first entry's 'resv' field)
+	struct io_uring_buf *buf = reinterpret_cast< struct io_uring_buf * >(uring.recv_ring) + (uring.recv_ring_tail & (UringRecvBuffers - 1));
+	buf->addr = uint64_t(reinterpret_cast< uintptr_t >(uring.recv_buffers + size_t(bid) * UringRecvBufferSize));
+	buf->len = UringRecvBufferSize;
+	buf->bid = bid;
+	uring.recv_ring_tail += 1;
+	__atomic_store_n(&ring->tail, uring.recv_ring_tail, __ATOMIC_RELEASE);
+}
+
+//(returns false if the queue was full)
+static bool uring_queue_recv(char const *where, Poller &poller, Socket socket, Connection *c) {
+	struct io_uring_sqe *sqe = uring_get_sqe(where, poller);
+	if (!sqe) return false;
+	sqe->opcode = IORING_OP_RECV;
+	sqe->fd = socket;
+	sqe->ioprio = IORING_RECV_MULTISHOT;
+	sqe->flags = IOSQE_BUFFER_SELECT;
+	sqe->buf_group = UringRecvGroup;
+	sqe->user_data = uring_data(c, UringRecv);
+	if (c) c->uring_ops += 1;
+	return true;
+}
 
+//(returns false if the queue was full)
+static bool uring_queue_send(char const *where, Poller &poller, Socket socket, uint8_t const *data, uint32_t size, Connection *c) {
+	struct io_uring_sqe *sqe = uring_get_sqe(where, poller);
+	if (!sqe) return false;
+	sqe->opcode = IORING_OP_SEND;
+	sqe->fd = socket;
+	sqe->addr = uint64_t(reinterpret_cast< uintptr_t >(data));
+	sqe->len = size;
+	sqe->msg_flags = MSG_NOSIGNAL;
+	sqe->user_data = uring_data(c, UringSend);
+	if (c) c->uring_ops += 1;
+	return true;
+}
 
-Server::Server(std::string const &port) {
+//send the rest of a connection's slot:
+static void uring_continue_send(
+	char const *where,
+	Poller &poller,
+	Connection &c,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	assert(c.uring_send_slot >= 0 && c.uring_send_offset < c.uring_send_size);
+	uint8_t const *data = poller.uring->send_arena + size_t(c.uring_send_slot) * UringSendSlotSize + c.uring_send_offset;
+	if (!uring_queue_send(where, poller, c.socket, data, c.uring_send_size - c.uring_send_offset, &c)) {
+		c.close();
+		if (on_event) on_event(&c, Connection::OnClose);
+	}
+}
+
+//copy as much of a connection's pending data as fits into a free slot and send it
+// (one slot per connection at a time; without a free slot, the connection waits its turn):
+static void uring_start_send(
+	char const *where,
+	Poller &poller,
+	Connection &c,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	IoUring &uring = *poller.uring;
+	if (c.socket == InvalidSocket || c.uring_send_slot >= 0 || c.send_pending() == 0) return;
+	if (uring.free_slots.empty()) {
+		if (!c.uring_waiting) {
+			uring.slot_waiters.emplace_back(&c);
+			c.uring_waiting = true;
+		}
+		return;
+	}
+	uint32_t slot = uring.free_slots.back();
+	uring.free_slots.pop_back();
+
+	uint8_t *data = uring.send_arena + size_t(slot) * UringSendSlotSize;
+	uint32_t size = 0;
+	const size_t MaxPieces = 16;
+	Connection::Piece pieces[MaxPieces];
+	size_t piece_count = c.peek_send(pieces, MaxPieces);
+	for (size_t i = 0; i < piece_count && size < UringSendSlotSize; ++i) {
+		uint32_t count = uint32_t(std::min< size_t >(pieces[i].size, UringSendSlotSize - size));
+		memcpy(data + size, pieces[i].data, count);
+		size += count;
+	}
+	c.consume_send(size);
+
+	c.uring_send_slot = int32_t(slot);
+	c.uring_send_offset = 0;
+	c.uring_send_size = size;
+	uring_continue_send(where, poller, c, on_event);
+}
+
+//a connection's send has finished (or failed); its slot goes to the first connection waiting for one:
+static void uring_release_slot(
+	char const *where,
+	Poller &poller,
+	Connection &c,
+	std::function< void(Connection *, Connection::Event event) > const &on_event) {
+
+	IoUring &uring = *poller.uring;
+	if (c.uring_send_slot < 0) return;
+	uring.free_slots.emplace_back(uint32_t(c.uring_send_slot));
+	c.uring_send_slot = -1;
+	while (!uring.free_slots.empty() && !uring.slot_waiters.empty()) {
+		Connection *waiter = uring.slot_waiters.front();
+		uring.slot_waiters.pop_front();
+		waiter->uring_waiting = false;
+		uring_start_send(where, poller, *waiter, on_event);
+	}
+}
+
+//set up the rings and buffers, and check the kernel can do everything used here;
+// returns false (having said why, and with poller.uring cleared) if not:
+static bool uring_setup(char const *where, Poller &poller) {
+	auto fail = [&](std::string const &why) {
+		std::cerr << "[" << where << "] io_uring unavailable (" << why << "); falling back to epoll." << std::endl;
+		poller.uring.reset();
+		return false;
+	};
+
+	poller.uring.reset(new IoUring);
+	IoUring &uring = *poller.uring;
+
+	{ //rings:
+		struct io_uring_params params;
+		memset(&params, 0, sizeof(params));
+		params.flags = IORING_SETUP_CQSIZE;
+		params.cq_entries = 2 * UringEntries;
+		uring.fd = int(syscall(__NR_io_uring_setup, UringEntries, &params));
+		if (uring.fd < 0) return fail(std::string("io_uring_setup: ") + strerror(errno));
+		uint32_t needed = IORING_FEAT_SINGLE_MMAP | IORING_FEAT_NODROP | IORING_FEAT_EXT_ARG;
+		if ((params.features & needed) != needed) return fail("kernel too old");
+
+		uring.rings_size = std::max(
+			params.sq_off.array + params.sq_entries * sizeof(uint32_t),
+			params.cq_off.cqes + params.cq_entries * sizeof(struct io_uring_cqe)
+		);
+		void *rings = mmap(nullptr, uring.rings_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQ_RING);
+		if (rings == MAP_FAILED) return fail(std::string("mmap: ") + strerror(errno));
+		uring.rings = rings;
+		uring.sqes_size = params.sq_entries * sizeof(struct io_uring_sqe);
+		void *sqes = mmap(nullptr, uring.sqes_size, PROT_READ | PROT_WRITE, MAP_SHARED | MAP_POPULATE, uring.fd, IORING_OFF_SQES);
+		if (sqes == MAP_FAILED) return fail(std::string("mmap: ") + strerror(errno));
+		uring.sqes = sqes;
+
+		uint8_t *base = reinterpret_cast< uint8_t * >(rings);
+		uring.sq_head = reinterpret_cast< uint32_t * >(base + params.sq_off.head);
+		uring.sq_tail = reinterpret_cast< uint32_t * >(base + params.sq_off.tail);
+		uring.sq_array = reinterpret_cast< uint32_t * >(base + params.sq_off.array);
+		uring.sq_mask = *reinterpret_cast< uint32_t * >(base + params.sq_off.ring_mask);
+		uring.sq_entries = params.sq_entries;
+		uring.cq_head = reinterpret_cast< uint32_t * >(base + params.cq_off.head);
+		uring.cq_tail = reinterpret_cast< uint32_t * >(base + params.cq_off.tail);
+		uring.cq_mask = *reinterpret_cast< uint32_t * >(base + params.cq_off.ring_mask);
+		uring.cqes = base + params.cq_off.cqes;
+		//(entry i of the submission queue is always sqes[i])
+		for (uint32_t i = 0; i < uring.sq_entries; ++i) {
+			uring.sq_array[i] = i;
+		}
+	}
+
+	{ //receive buffers, handed over through a registered ring:
+		uring.recv_buffers = uring_map(size_t(UringRecvBuffers) * UringRecvBufferSize);
+		uring.recv_ring_size = UringRecvBuffers * sizeof(struct io_uring_buf);
+		uring.recv_ring = uring_map(uring.recv_ring_size);
+		if (!uring.recv_buffers || !uring.recv_ring) return fail("out of memory");
+		struct io_uring_buf_reg reg;
+		memset(&reg, 0, sizeof(reg));
+		reg.ring_addr = uint64_t(reinterpret_cast< uintptr_t >(uring.recv_ring));
+		reg.ring_entries = UringRecvBuffers;
+		reg.bgid = UringRecvGroup;
+		if (syscall(__NR_io_uring_register, uring.fd, IORING_REGISTER_PBUF_RING, &reg, 1) != 0) {
+			return fail(std::string("registering receive buffers: ") + strerror(errno));
+		}
+		for (uint32_t bid = 0; bid < UringRecvBuffers; ++bid) {
+			uring_recycle(uring, uint16_t(bid));
+		}
+	}
+
+	{ //send arena:
+		//n.b. not registered: the kernel only takes registered buffers for zero-copy sends, whose page
+		// pinning and extra completion cost more than copying a snapshot of a few hundred bytes.
+		uring.send_arena = uring_map(size_t(UringSendSlots) * UringSendSlotSize);
+		if (!uring.send_arena) return fail("out of memory");
+		for (uint32_t slot = UringSendSlots; slot > 0; --slot) {
+			uring.free_slots.emplace_back(slot - 1);
+		}
+	}
+
+	{ //try a multishot receive and a send on a socket pair:
+		int pair[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) != 0) return fail(std::string("socketpair: ") + strerror(errno));
+		auto next_completion = [&](struct io_uring_cqe *cqe) {
+			for (uint32_t tries = 0; tries < 2; ++tries) {
+				uint32_t head = *uring.cq_head;
+				if (head != __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE)) {
+					*cqe = reinterpret_cast< struct io_uring_cqe * >(uring.cqes)[head & uring.cq_mask];
+					__atomic_store_n(uring.cq_head, head + 1, __ATOMIC_RELEASE);
+					if (cqe->flags & IORING_CQE_F_BUFFER) uring_recycle(uring, uint16_t(cqe->flags >> IORING_CQE_BUFFER_SHIFT));
+					return true;
+				}
+				uring_enter(where, poller, 1, 1.0);
+			}
+			return false;
+		};
+		uring.send_arena[0] = 'x';
+		uring_queue_recv(where, poller, pair[0], nullptr);
+		uring_queue_send(where, poller, pair[1], uring.send_arena, 1, nullptr);
+		bool received = false, sent = false, recv_done = false;
+		struct io_uring_cqe cqe;
+		while (!(received && sent) && next_completion(&cqe)) {
+			if ((cqe.user_data & UringKindMask) == UringRecv) {
+				recv_done = !(cqe.flags & IORING_CQE_F_MORE);
+				if (cqe.res != 1) break;
+				received = true;
+			} else if ((cqe.user_data & UringKindMask) == UringSend) {
+				if (cqe.res != 1) break;
+				sent = true;
+			}
+		}
+		//(the receive ends once it sees the other end close)
+		::close(pair[1]);
+		while (!recv_done && next_completion(&cqe)) {
+			if ((cqe.user_data & UringKindMask) == UringRecv) recv_done = !(cqe.flags & IORING_CQE_F_MORE);
+		}
+		::close(pair[0]);
+		if (!received) return fail("multishot receive didn't work");
+		if (!sent) return fail("send didn't work");
+		if (!recv_done) return fail("receive didn't finish");
+	}
+
+	std::cout << "[" << where << "] using io_uring." << std::endl;
+	return true;
+}
+
+//handle one completion:
+static void uring_complete(
+	char const *where,
+	Poller &poller,
+	std::list< Connection > &connections,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	struct io_uring_cqe const &cqe) {
+
+	IoUring &uring = *poller.uring;
+	UringKind kind = UringKind(cqe.user_data & UringKindMask);
+	Connection *c = reinterpret_cast< Connection * >(uintptr_t(cqe.user_data & ~uint64_t(UringKindMask)));
+	bool more = (cqe.flags & IORING_CQE_F_MORE);
+
+	if (kind == UringAccept) {
+		if (!more) uring.accept_armed = false;
+		if (cqe.res < 0) {
+			if (cqe.res != -ECANCELED) std::cerr << "[" << where << "] accept failed: " << strerror(-cqe.res) << std::endl;
+			return;
+		}
+		Connection &added = add_connection(connections, poller, Socket(cqe.res));
+		std::cerr << "[" << where << "] client connected on " << added.socket << "." << std::endl; //INFO
+		if (!uring_queue_recv(where, poller, added.socket, &added)) {
+			added.close();
+			return;
+		}
+		if (on_event) on_event(&added, Connection::OnOpen);
+	} else if (kind == UringWake) {
+		if (!more) uring.wake_armed = false;
+		if (cqe.res > 0) drain_wake(poller);
+	} else if (kind == UringRecv) {
+		if (c && !more) c->uring_ops -= 1;
+		bool live = (c && c->socket != InvalidSocket);
+		if (cqe.flags & IORING_CQE_F_BUFFER) {
+			uint16_t bid = uint16_t(cqe.flags >> IORING_CQE_BUFFER_SHIFT);
+			if (live && cqe.res > 0) c->recv_buffer.append(uring.recv_buffers + size_t(bid) * UringRecvBufferSize, size_t(cqe.res));
+			uring_recycle(uring, bid);
+		}
+		if (!live) return;
+		if (cqe.res > 0 || cqe.res == -ENOBUFS) {
+			if (cqe.res > 0 && on_event) on_event(c, Connection::OnRecv);
+			//(a receive that ran out of buffers ends, and is re-armed now that they've been recycled)
+			if (c->socket != InvalidSocket && !more && !uring_queue_recv(where, poller, c->socket, c)) {
+				c->close();
+				if (on_event) on_event(c, Connection::OnClose);
+			}
+		} else {
+			if (cqe.res == 0) {
+				std::cerr << "[" << where << "] port closed, disconnecting." << std::endl;
+			} else {
+				std::cerr << "[" << where << "] recv returned error " << -cqe.res << "(" << strerror(-cqe.res) << "), disconnecting." << std::endl;
+			}
+			c->close();
+			if (on_event) on_event(c, Connection::OnClose);
+		}
+	} else if (kind == UringSend) {
+		if (!c) return;
+		c->uring_ops -= 1;
+		if (c->socket == InvalidSocket) {
+			uring_release_slot(where, poller, *c, on_event);
+		} else if (cqe.res == -EINTR || cqe.res == -EAGAIN) {
+			uring_continue_send(where, poller, *c, on_event);
+		} else if (cqe.res <= 0 || uint32_t(cqe.res) > c->uring_send_size - c->uring_send_offset) {
+			std::cerr << "[" << where << "] send returned " << cqe.res << " of " << (c->uring_send_size - c->uring_send_offset) << " bytes, disconnecting." << std::endl;
+			uring_release_slot(where, poller, *c, on_event);
+			c->close();
+			if (on_event) on_event(c, Connection::OnClose);
+		} else {
+			c->uring_send_offset += uint32_t(cqe.res);
+			if (c->uring_send_offset < c->uring_send_size) {
+				uring_continue_send(where, poller, *c, on_event);
+			} else {
+				uring_release_slot(where, poller, *c, on_event);
+				uring_start_send(where, poller, *c, on_event);
+			}
+		}
+	}
+	//(UringCancel: nothing to do; the cancelled request completes on its own)
+}
+
+static void uring_poll_connections(
+	char const *where,
+	Poller &poller,
+	std::list< Connection > &connections,
+	std::function< void(Connection *, Connection::Event event) > const &on_event,
+	double timeout,
+	Socket listen_socket) {
+
+	IoUring &uring = *poller.uring;
+
+	//(re-)arm the multishot requests that don't belong to a connection:
+	if (!uring.accept_armed) {
+		if (struct io_uring_sqe *sqe = uring_get_sqe(where, poller)) {
+			sqe->opcode = IORING_OP_ACCEPT;
+			sqe->fd = listen_socket;
+			sqe->ioprio = IORING_ACCEPT_MULTISHOT;
+			sqe->user_data = uring_data(nullptr, UringAccept);
+			uring.accept_armed = true;
+		}
+	}
+	if (!uring.wake_armed && poller.wake_recv != InvalidSocket) {
+		if (struct io_uring_sqe *sqe = uring_get_sqe(where, poller)) {
+			sqe->opcode = IORING_OP_POLL_ADD;
+			sqe->fd = poller.wake_recv;
+			sqe->len = IORING_POLL_ADD_MULTI;
+			sqe->poll32_events = POLLIN;
+			sqe->user_data = uring_data(nullptr, UringWake);
+			uring.wake_armed = true;
+		}
+	}
+
+	{ //everything queued since the last poll gets a send request (or waits for a slot):
+		static thread_local std::vector< Connection * > queued;
+		queued.clear();
+		{
+			std::lock_guard< std::mutex > lock(poller.mutex);
+			std::swap(queued, poller.send_queued);
+		}
+		for (Connection *c : queued) {
+			c->send_queued = false;
+			uring_start_send(where, poller, *c, on_event);
+		}
+	}
+
+	//submit all of that and wait for completions, in one call:
+	// (without waiting if some are already there)
+	uint32_t head = *uring.cq_head;
+	bool ready = (head != __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE));
+	if (!ready || uring.unsubmitted) uring_enter(where, poller, ready ? 0 : 1, timeout);
+
+	//handle the completions that are there now:
+	// (copied out and consumed one by one, since handling them may submit more)
+	uint32_t tail = __atomic_load_n(uring.cq_tail, __ATOMIC_ACQUIRE);
+	while (head != tail) {
+		struct io_uring_cqe cqe = reinterpret_cast< struct io_uring_cqe * >(uring.cqes)[head & uring.cq_mask];
+		head += 1;
+		__atomic_store_n(uring.cq_head, head, __ATOMIC_RELEASE);
+		uring_complete(where, poller, connections, on_event, cqe);
+	}
+}
+
+//like reap_closed(), but connections with requests in flight have those cancelled, and are
+// only removed once they finish:
+static void uring_reap_closed(char const *where, std::list< Connection > &connections, Poller &poller) {
+	IoUring &uring = *poller.uring;
+	static thread_local std::vector< Connection * > closed;
+	closed.clear();
+	{
+		std::lock_guard< std::mutex > lock(poller.mutex);
+		std::swap(closed, poller.closed);
+		for (Connection *c : closed) {
+			if (!c->send_queued) continue;
+			auto f = std::find(poller.send_queued.begin(), poller.send_queued.end(), c);
+			if (f != poller.send_queued.end()) {
+				*f = poller.send_queued.back();
+				poller.send_queued.pop_back();
+			}
+		}
+	}
+	for (Connection *c : closed) {
+		if (c->uring_waiting) {
+			auto f = std::find(uring.slot_waiters.begin(), uring.slot_waiters.end(), c);
+			if (f != uring.slot_waiters.end()) uring.slot_waiters.erase(f);
+			c->uring_waiting = false;
+		}
+		if (c->uring_ops == 0) {
+			connections.erase(c->self);
+			continue;
+		}
+		for (UringKind kind : { UringRecv, UringSend }) {
+			if (kind == UringSend && c->uring_send_slot < 0) continue;
+			if (struct io_uring_sqe *sqe = uring_get_sqe(where, poller)) {
+				sqe->opcode = IORING_OP_ASYNC_CANCEL;
+				sqe->addr = uring_data(c, kind);
+				sqe->user_data = uring_data(nullptr, UringCancel);
+			}
+		}
+		uring.closing.emplace_back(c);
+	}
+	for (uint32_t i = 0; i < uring.closing.size(); /* later */) {
+		if (uring.closing[i]->uring_ops == 0) {
+			connections.erase(uring.closing[i]->self);
+			uring.closing[i] = uring.closing.back();
+			uring.closing.pop_back();
+		} else {
+			++i;
+		}
+	}
+}
+#endif //CONNECTION_USE_IO_URING
+
+//---------------------------------
+
+
+Server::Server(std::string const &port, Transport transport, PollBackend backend) {
+	poller.transport = transport;
+
+	#ifndef _WIN32
+	{ //socket pair that wake() writes to, watched along with everything else:
+		int pair[2];
+		if (socketpair(AF_UNIX, SOCK_STREAM, 0, pair) == 0) {
+			poller.wake_recv = pair[0];
+			poller.wake_send = pair[1];
+			set_nonblocking(poller.wake_recv);
+			set_nonblocking(poller.wake_send);
+		} else {
+			std::cerr << "[Server::Server] socketpair failed (" << strerror(errno) << "); wake() will do nothing." << std::endl;
+		}
+	}
+	#endif
 
 	#ifdef _WIN32
 	{ //init winsock:
@@ -199,7 +1535,7 @@ Server::Server(std::string const &port) {
 		struct addrinfo hints;
 		memset(&hints, 0, sizeof(hints));
 		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
+		hints.ai_socktype = (transport == Transport::UDP ? SOCK_DGRAM : SOCK_STREAM);
 		hints.ai_flags = AI_PASSIVE;
 
 		struct addrinfo *res = nullptr;
@@ -254,40 +1590,116 @@ Server::Server(std::string const &port) {
 			}
 			std::cout << "success!" << std::endl;
 
-			listen_socket = s;
+			if (transport == Transport::UDP) poller.udp_socket = s;
+			else listen_socket = s;
 			break;
 		}
 
 		freeaddrinfo(res);
 	}
 
+	if (transport == Transport::UDP) {
+		if (poller.udp_socket == InvalidSocket) {
+			throw std::runtime_error("Failed to bind to port " + port);
+		}
+		//every client shares this one socket:
+		set_nonblocking(poller.udp_socket);
+		//(room for a whole tick's worth of snapshots to every client; fine if the OS won't allow it)
+		int buffer_size = 4 << 20;
+		setsockopt(poller.udp_socket, SOL_SOCKET, SO_SNDBUF, reinterpret_cast< char const * >(&buffer_size), sizeof(buffer_size));
+		setsockopt(poller.udp_socket, SOL_SOCKET, SO_RCVBUF, reinterpret_cast< char const * >(&buffer_size), sizeof(buffer_size));
+		return;
+	}
+
 	if (listen_socket == InvalidSocket) {
 		throw std::runtime_error("Failed to bind to port " + port);
 	}
 
 	{ //listen on socket
-		int ret = ::listen(listen_socket, 5);
+		//(generous backlog, so a burst of joining clients doesn't get dropped between polls)
+		int ret = ::listen(listen_socket, SOMAXCONN);
 		if (ret < 0) {
 			closesocket(listen_socket);
 			throw std::system_error(errno, std::system_category(), "failed to listen on socket");
 		}
 	}
+
+	#ifdef TCP_NOTSENT_LOWAT
+	{ //keep only a little unsent data in the kernel (accepted sockets inherit this):
+		// otherwise a slow client's socket buffer soaks up seconds of states, where stale ones can't be dropped;
+		// past this, sends wait in the connection's own queue instead (see Connection::send_droppable).
+		// (doesn't limit data in flight, so fast clients aren't slowed down)
+		int lowat = 8 << 10;
+		if (setsockopt(listen_socket, IPPROTO_TCP, TCP_NOTSENT_LOWAT, &lowat, sizeof(lowat)) != 0) {
+			std::cerr << "[Server::Server] couldn't set TCP_NOTSENT_LOWAT: " << strerror(errno) << std::endl;
+		}
+	}
+	#endif
+
+	#ifdef CONNECTION_USE_IO_URING
+	if (backend == PollBackend::IoUring && uring_setup("Server::Server", poller)) return;
+	#else
+	if (backend == PollBackend::IoUring) {
+		std::cerr << "[Server::Server] io_uring isn't available in this build; using the default backend." << std::endl;
+	}
+	#endif
+
+	#ifdef CONNECTION_USE_EPOLL
+	{ //watch the listen socket for new connections:
+		//(non-blocking, so each readiness edge can accept every pending connection)
+		int flags = fcntl(listen_socket, F_GETFL, 0);
+		if (flags < 0 || fcntl(listen_socket, F_SETFL, flags | O_NONBLOCK) != 0) {
+			closesocket(listen_socket);
+			throw std::system_error(errno, std::system_category(), "failed to make listen socket non-blocking");
+		}
+		poller.epoll_fd = epoll_create_or_warn("Server::Server");
+		if (poller.epoll_fd >= 0) epoll_register("Server::Server", poller, listen_socket, nullptr);
+		if (poller.epoll_fd >= 0 && poller.wake_recv != InvalidSocket) {
+			//(registered with the poller itself as its pointer, to tell it apart from connections)
+			struct epoll_event ev;
+			memset(&ev, 0, sizeof(ev));
+			ev.events = EPOLLIN | EPOLLET;
+			ev.data.ptr = &poller;
+			if (epoll_ctl(poller.epoll_fd, EPOLL_CTL_ADD, poller.wake_recv, &ev) != 0) {
+				std::cerr << "[Server::Server] epoll_ctl(ADD) failed for wake socket: " << strerror(errno) << std::endl;
+			}
+		}
+	}
+	#endif
 }
 
 void Server::poll(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
-	poll_connections("Server::poll", connections, on_event, timeout, listen_socket);
+	if (poller.transport == Transport::UDP) udp_poll_connections("Server::poll", poller, connections, on_event, timeout, true);
+	else
+	#ifdef CONNECTION_USE_IO_URING
+	if (poller.uring) {
+		uring_poll_connections("Server::poll", poller, connections, on_event, timeout, listen_socket);
+		uring_reap_closed("Server::poll", connections, poller);
+		return;
+	} else
+	#endif
+	#ifdef CONNECTION_USE_EPOLL
+	if (poller.epoll_fd >= 0) epoll_poll_connections("Server::poll", poller, connections, on_event, timeout, listen_socket);
+	else
+	#endif
+	poll_connections("Server::poll", poller, connections, on_event, timeout, listen_socket);
 
 	//reap closed clients:
-	for (auto connection = connections.begin(); connection != connections.end(); /*later*/) {
-		auto old = connection;
-		++connection;
-		if (old->socket == InvalidSocket) {
-			connections.erase(old);
-		}
-	}
+	reap_closed(connections, poller);
 }
 
-Client::Client(std::string const &host, std::string const &port) : connections(1), connection(connections.front()) {
+void Server::wake() {
+	if (poller.wake_send == InvalidSocket) return;
+	if (poller.wake_pending.exchange(true)) return; //(already on its way)
+	char byte = 1;
+	send(poller.wake_send, &byte, 1, MSG_DONTWAIT);
+}
+
+Client::Client(std::string const &host, std::string const &port, Transport transport) : connections(1), connection(connections.front()) {
+	connection.poller = &poller;
+	connection.self = connections.begin();
+	poller.transport = transport;
+
 	#ifdef _WIN32
 	{ //init winsock:
 		WSADATA info;
@@ -301,8 +1713,8 @@ Client::Client(std::string const &host, std::string const &port) : connections(1
 		struct addrinfo hints;
 		memset(&hints, 0, sizeof(hints));
 		hints.ai_family = AF_UNSPEC;
-		hints.ai_socktype = SOCK_STREAM;
-		hints.ai_protocol = IPPROTO_TCP;
+		hints.ai_socktype = (transport == Transport::UDP ? SOCK_DGRAM : SOCK_STREAM);
+		hints.ai_protocol = (transport == Transport::UDP ? IPPROTO_UDP : IPPROTO_TCP);
 
 		struct addrinfo *res = nullptr;
 		int addrinfo_ret = getaddrinfo(host.c_str(), port.c_str(), &hints, &res);
@@ -335,6 +1747,44 @@ Client::Client(std::string const &host, std::string const &port) : connections(1
 				std::cout << "(failed to create socket: " << strerror(errno) << ")" << std::endl;
 				continue;
 			}
+			if (transport == Transport::UDP) {
+				//say hello until the server answers (or give up on this address):
+				set_nonblocking(s);
+				auto peer = std::make_unique< UdpPeer >();
+				peer->address.assign(reinterpret_cast< char const * >(info->ai_addr), info->ai_addrlen);
+				bool welcomed = false;
+				for (uint32_t attempt = 0; attempt < 8 && !welcomed; ++attempt) {
+					udp_send_kind(nullptr, s, *peer, UdpHello);
+					auto give_up = after(std::chrono::steady_clock::now(), 0.25);
+					while (!welcomed) {
+						double wait = seconds_between(std::chrono::steady_clock::now(), give_up);
+						if (wait <= 0.0) break;
+						fd_set read_fds;
+						FD_ZERO(&read_fds);
+						FD_SET(s, &read_fds);
+						struct timeval tv;
+						tv.tv_sec = 0;
+						tv.tv_usec = std::lround(wait * 1e6);
+						if (select(int(s) + 1, &read_fds, NULL, NULL, &tv) <= 0) continue;
+						uint8_t reply[16];
+						struct sockaddr_storage from;
+						socklen_t from_len = sizeof(from);
+						ssize_t got = recvfrom(s, reinterpret_cast< char * >(reply), sizeof(reply), MSG_DONTWAIT, reinterpret_cast< struct sockaddr * >(&from), &from_len);
+						if (got == 1 && reply[0] == UdpWelcome && std::string(reinterpret_cast< char const * >(&from), from_len) == peer->address) welcomed = true;
+					}
+				}
+				if (!welcomed) {
+					std::cout << "(no answer)" << std::endl;
+					closesocket(s);
+					continue;
+				}
+				std::cout << "success!" << std::endl;
+				peer->last_recv = std::chrono::steady_clock::now();
+				connection.udp = std::move(peer);
+				connection.socket = s;
+				poller.udp_socket = s;
+				break;
+			}
 			int ret = connect(s, info->ai_addr, int(info->ai_addrlen));
 			if (ret < 0) {
 				std::cout << "(failed to connect: " << strerror(errno) << ")" << std::endl;
@@ -352,10 +1802,27 @@ Client::Client(std::string const &host, std::string const &port) : connections(1
 			throw std::runtime_error("Failed to connect to any of the addresses tried for server.");
 		}
 	}
+
+	if (transport == Transport::UDP) return;
+
+	#ifdef CONNECTION_USE_EPOLL
+	poller.epoll_fd = epoll_create_or_warn("Client::Client");
+	if (poller.epoll_fd >= 0) epoll_register("Client::Client", poller, connection.socket, &connection);
+	#endif
 }
 
 
 void Client::poll(std::function< void(Connection *, Connection::Event event) > const &on_event, double timeout) {
-	poll_connections("Client::poll", connections, on_event, timeout, InvalidSocket);
+	if (poller.transport == Transport::UDP) udp_poll_connections("Client::poll", poller, connections, on_event, timeout, false);
+	else
+	#ifdef CONNECTION_USE_EPOLL
+	if (poller.epoll_fd >= 0) epoll_poll_connections("Client::poll", poller, connections, on_event, timeout, InvalidSocket);
+	else
+	#endif
+	poll_connections("Client::poll", poller, connections, on_event, timeout, InvalidSocket);
+
+	//(the client's one connection is never removed, even once closed)
+	std::lock_guard< std::mutex > lock(poller.mutex);
+	poller.closed.clear();
 }
 
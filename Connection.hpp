@@ -14,7 +14,7 @@ int main(int argc, char **argv) {
 		server.poll([](Connection *connection, Connection::Event evt){
 			if (evt == Connection::OnRecv) {
 				//extract and erase data from the connection's recv_buffer:
-				std::vector< uint8_t > data = connection->recv_buffer;
+				std::vector< uint8_t > data(connection->recv_buffer.begin(), connection->recv_buffer.end());
 				connection->recv_buffer.clear();
 				//send to other connections:
 
@@ -60,11 +60,105 @@ int main(int argc, char **argv) {
 #endif
 //--------- ---------------------------------- ---------
 
+//--------- readiness backend -------
+//on linux, sockets are watched with (edge-triggered) epoll, so the cost of a poll depends only on
+//  the sockets that are ready and there is no FD_SETSIZE limit on connections; elsewhere (or if epoll
+//  can't be set up) select() is used:
+#if defined(__linux__)
+	#define CONNECTION_USE_EPOLL 1
+#endif
+//a TCP Server on linux can instead use io_uring (see PollBackend), if the kernel headers know about it:
+#if defined(__linux__) && defined(__has_include)
+	#if __has_include(<linux/io_uring.h>)
+		#define CONNECTION_USE_IO_URING 1
+	#endif
+#endif
+//--------- ---------------------------------- ---------
+
 #include <vector>
 #include <list>
 #include <string>
 #include <functional>
 #include <cstdint>
+#include <mutex>
+#include <memory>
+#include <deque>
+#include <map>
+#include <unordered_map>
+#include <chrono>
+#include <random>
+#include <atomic>
+
+#include "ByteQueue.hpp"
+
+struct Poller;
+
+//--------- transport -------
+//Server/Client can talk over one TCP stream per client (the default), or over UDP:
+// with UDP, droppable messages (e.g., state snapshots; see Connection::send_droppable) go out as
+// sequenced datagrams that may be lost or superseded, and everything else goes over a small reliable
+// channel (sequence numbers, acks, retransmission) so it still arrives complete and in order.
+enum class Transport {
+	TCP,
+	UDP,
+};
+//--------- ---------------------------------- ---------
+
+//--------- polling backend -------
+//how a TCP Server waits for and moves data:
+enum class PollBackend {
+	Readiness, //wait for sockets to be ready (epoll or select), then one recv()/sendmsg() per socket
+	//(linux) io_uring: receives land in registered buffers without a call per socket, and every send
+	// queued since the last poll goes out in the same single io_uring_enter() as the wait.
+	// Falls back to Readiness if the kernel can't do it (needs multishot receive, linux 6.0+):
+	IoUring,
+};
+//--------- ---------------------------------- ---------
+
+//immutable bytes that can be queued on many connections at once (e.g., a state snapshot):
+typedef std::shared_ptr< std::vector< uint8_t > const > SharedBytes;
+
+//per-connection UDP bookkeeping (internals):
+struct UdpPeer {
+	typedef std::chrono::steady_clock::time_point Time;
+
+	std::string address; //peer's sockaddr, as raw bytes
+	bool shared_socket = false; //socket belongs to the Server (don't close it with the connection)
+	Time last_recv; //for timing out silent peers
+	Time last_send; //for keepalives
+
+	//reliable channel, sending: queued bytes are cut into sequenced fragments, resent until acked:
+	struct Fragment {
+		uint32_t seq = 0;
+		std::vector< uint8_t > bytes; //whole datagram (header included)
+		Time sent_at;
+		uint32_t sends = 0;
+		bool acked = false;
+	};
+	std::deque< Fragment > in_flight; //consecutive seqs, oldest first
+	uint32_t next_send_seq = 0;
+	double rtt = 0.1; //smoothed round-trip estimate (seconds)
+
+	//reliable channel, receiving: fragments are reassembled in order, then split into whole messages:
+	uint32_t next_recv_seq = 0;
+	std::map< uint32_t, std::vector< uint8_t > > early; //fragments that arrived ahead of next_recv_seq
+	ByteQueue reliable_recv; //in-order bytes not yet making up a whole message
+	bool ack_queued = false; //(in poller->udp_ack_queued)
+
+	//droppable messages, sending: only the newest one queued since the last poll goes out:
+	std::vector< uint8_t > droppable_prefix;
+	SharedBytes droppable_bytes;
+	bool droppable_queued = false;
+	uint32_t next_droppable_seq = 1;
+	uint64_t droppable_superseded = 0; //queued, but replaced by a newer one before being sent
+
+	//droppable messages, receiving: one message is reassembled at a time (the newest seen):
+	uint32_t delivered_seq = 0; //newest droppable message delivered (older ones are ignored)
+	uint32_t partial_seq = 0;
+	std::vector< std::vector< uint8_t > > partial; //fragments by index (empty => not yet arrived)
+	uint32_t partial_missing = 0;
+	uint64_t droppable_lost = 0; //droppable messages skipped over (never completed)
+};
 
 //Thin wrapper around a (polling-based) TCP socket connection:
 struct Connection {
@@ -75,22 +169,79 @@ struct Connection {
 	}
 	//Helper that will append raw bytes to the send buffer:
 	void send_raw(void const *data, size_t size) {
-		send_buffer.insert(send_buffer.end(), reinterpret_cast< uint8_t const * >(data), reinterpret_cast< uint8_t const * >(data) + size);
+		send_buffer.append(data, size);
+		if (!send_queued) queue_send();
 	}
 
+	//Queue shared bytes after everything sent so far, without copying them:
+	void send_shared(SharedBytes const &bytes);
+
+	//Queue a message that may be dropped in favor of a newer one (e.g., a state snapshot), as
+	// prefix bytes (copied; at most MaxDroppablePrefix) followed by shared bytes:
+	// over TCP it is queued after everything sent so far, but if the previous droppable message hasn't
+	// started going out yet (the client is reading slowly), that one is dropped; over UDP it goes out as
+	// its own sequenced datagram(s), only the newest message queued since the last poll is sent, and the
+	// receiver ignores it if something newer arrived first. Either way it arrives whole (never interleaved
+	// with other messages). Dropped messages are counted in Poller::droppable_superseded.
+	void send_droppable(void const *prefix, size_t prefix_size, SharedBytes const &bytes);
+	inline static constexpr size_t MaxDroppablePrefix = 32;
+
+	//Bytes queued but not yet handed to the socket:
+	size_t send_pending() const { return send_buffer.size() + send_shared_bytes; }
+	//Bytes handed to the socket so far (e.g., to notice a client that has stopped reading):
+	uint64_t bytes_sent = 0;
+
 	//Call 'close' to mark a connection for discard:
 	void close();
 
 	//so you can if(connection) ... to check for validity:
 	explicit operator bool() { return socket != InvalidSocket; }
 
-	//To send data over a connection, append it to send_buffer:
-	std::vector< uint8_t > send_buffer;
-	//When the connection receives data, it is appended to recv_buffer:
-	std::vector< uint8_t > recv_buffer;
+	//To send data over a connection, append it to send_buffer with send() / send_raw():
+	// (they also tell the next poll() that this connection has something to send)
+	ByteQueue send_buffer;
+	//When the connection receives data, it is appended to recv_buffer (consume() what you parse):
+	ByteQueue recv_buffer;
 
 	//internals:
 	Socket socket = InvalidSocket;
+	Poller *poller = nullptr; //bookkeeping of the Server/Client that owns this connection
+	std::list< Connection >::iterator self; //position in owner's connections list (for O(1) removal)
+	std::unique_ptr< UdpPeer > udp; //(only for Transport::UDP connections)
+	bool write_interest = false; //is the socket being watched for writability? (only while send_pending() != 0)
+	bool send_queued = false; //is this connection in poller->send_queued?
+	void queue_send();
+	#ifdef CONNECTION_USE_IO_URING
+	//io_uring backend (see IoUring):
+	uint32_t uring_ops = 0; //requests in flight that refer to this connection (it isn't freed until they finish)
+	int32_t uring_send_slot = -1; //registered send buffer being written from (-1 => no send in flight)
+	uint32_t uring_send_offset = 0; //bytes of the slot already written
+	uint32_t uring_send_size = 0; //bytes in the slot
+	bool uring_waiting = false; //is this connection in uring->slot_waiters?
+	#endif
+
+	//shared buffers queued by send_shared() (or, over TCP, send_droppable()), interleaved with send_buffer:
+	struct SharedSegment {
+		size_t before = 0; //bytes at the front of send_buffer that go out ahead of this segment
+		SharedBytes bytes;
+		size_t offset = 0; //bytes of prefix + 'bytes' already sent
+		bool droppable = false; //(from send_droppable; may be dropped while offset is zero)
+		uint8_t prefix_size = 0;
+		uint8_t prefix[MaxDroppablePrefix]; //(send_droppable's prefix; goes out just before 'bytes')
+		size_t size() const { return prefix_size + bytes->size(); }
+	};
+	std::deque< SharedSegment > send_segments;
+	size_t send_segments_before = 0; //sum of 'before' over send_segments
+	size_t send_shared_bytes = 0; //unsent bytes in send_segments
+
+	//pending bytes, in order, as (at most max_pieces) contiguous pieces; returns number of pieces:
+	struct Piece {
+		uint8_t const *data;
+		size_t size;
+	};
+	size_t peek_send(Piece *pieces, size_t max_pieces) const;
+	//drop bytes that have been sent from the front of the pending bytes:
+	void consume_send(size_t count);
 
 	enum Event {
 		OnOpen,
@@ -99,8 +250,82 @@ struct Connection {
 	};
 };
 
+#ifdef CONNECTION_USE_IO_URING
+//io_uring rings and buffers for a Server (internals; see the io_uring section of Connection.cpp):
+struct IoUring {
+	~IoUring(); //(unmaps and closes everything)
+	int fd = -1;
+
+	//submission and completion queues (shared with the kernel):
+	void *rings = nullptr; size_t rings_size = 0;
+	void *sqes = nullptr; size_t sqes_size = 0;
+	uint32_t *sq_head = nullptr, *sq_tail = nullptr, *sq_array = nullptr;
+	uint32_t sq_mask = 0, sq_entries = 0;
+	uint32_t *cq_head = nullptr, *cq_tail = nullptr;
+	uint32_t cq_mask = 0;
+	void *cqes = nullptr;
+	uint32_t unsubmitted = 0; //entries added since the last io_uring_enter()
+
+	//receives go into 'recv_buffers', handed to the kernel through a registered ring it picks from:
+	void *recv_ring = nullptr; size_t recv_ring_size = 0;
+	uint8_t *recv_buffers = nullptr;
+	uint16_t recv_ring_tail = 0;
+
+	//sends are copied into fixed-size slots of 'send_arena', one slot per connection at a time:
+	uint8_t *send_arena = nullptr;
+	std::vector< uint32_t > free_slots;
+	std::deque< Connection * > slot_waiters; //connections with data to send, waiting for a free slot
+
+	std::vector< Connection * > closing; //closed connections with requests still in flight
+	bool accept_armed = false;
+	bool wake_armed = false;
+};
+#endif
+
+//per-Server/Client bookkeeping, kept up to date as connections change so poll() only has to visit
+// connections that are ready or have something new to send (internals):
+struct Poller {
+	//send() may be called from several threads (e.g., one per match), so the lists are locked:
+	std::mutex mutex;
+	std::vector< Connection * > send_queued; //connections with data queued since the last poll()
+	std::vector< Connection * > closed; //connections closed since the last poll() (to be removed)
+
+	#ifdef CONNECTION_USE_EPOLL
+	int epoll_fd = -1; //(-1 => select() fallback)
+	#endif
+
+	//wake-up for a poll() waiting on another thread (see Server::wake), as a connected socket pair:
+	// (not on windows, where a poll() only returns on socket events or timeout)
+	Socket wake_recv = InvalidSocket;
+	Socket wake_send = InvalidSocket;
+	std::atomic< bool > wake_pending{false}; //(so a burst of wake() calls writes one byte)
+
+	#ifdef CONNECTION_USE_IO_URING
+	std::unique_ptr< IoUring > uring; //(only for PollBackend::IoUring)
+	#endif
+
+	//system calls made by poll() and the socket I/O it does (for comparing backends):
+	std::atomic< uint64_t > syscalls{0};
+	//droppable messages dropped unsent because a newer one was queued (see Connection::send_droppable):
+	std::atomic< uint64_t > droppable_superseded{0};
+
+	//Transport::UDP:
+	Transport transport = Transport::TCP;
+	Socket udp_socket = InvalidSocket; //(server: shared by every connection; client: the connection's socket)
+	std::unordered_map< std::string, Connection * > udp_peers; //by peer address (server only)
+	std::vector< Connection * > udp_ack_queued; //connections that received reliable data this poll
+	UdpPeer::Time udp_next_timer; //earliest resend / keepalive / timeout check
+	//loss injection, for testing: fraction of outgoing datagrams silently dropped:
+	double drop_rate = 0.0;
+	std::mt19937 drop_rng;
+	uint64_t datagrams_sent = 0;
+	uint64_t datagrams_dropped = 0;
+};
+
 struct Server {
-	Server(std::string const &port); //pass the port number to listen on, as a string (servname, really)
+	//pass the port number to listen on, as a string (servname, really):
+	// (backend only matters for TCP)
+	Server(std::string const &port, Transport transport = Transport::TCP, PollBackend backend = PollBackend::Readiness);
 
 	//poll() updates the list of active connections and sends/receives data if possible:
 	// (will wait up to 'timeout' for first event)
@@ -109,13 +334,18 @@ struct Server {
 		double timeout = 0.0 //timeout (seconds)
 	);
 
+	//make a poll() that is waiting (on another thread) return soon; may be called from any thread:
+	void wake();
+
 	std::list< Connection > connections;
 	Socket listen_socket = InvalidSocket;
+	Poller poller;
 };
 
 
 struct Client {
-	Client(std::string const &host, std::string const &port);
+	//(over UDP, waits for the server to answer before returning)
+	Client(std::string const &host, std::string const &port, Transport transport = Transport::TCP);
 
 	//poll() checks the status of the active connection and sends/receives data if possible:
 	// (will wait up to 'timeout' for first event)
@@ -126,4 +356,5 @@ struct Client {
 
 	std::list< Connection > connections; //will only ever contain exactly one connection
 	Connection &connection; //reference to the only connection in the connections list
+	Poller poller;
 };
@@ -2,39 +2,23 @@
 #include "Game.hpp"
 
 #include "Connection.hpp"
+#include "Profiler.hpp"
+#include "BodyCodec.hpp"
 
 #include <stdexcept>
 #include <iostream>
+#include <fstream>
+#include <filesystem>
+#include <cstdio>
 #include <cstring>
+#include <algorithm>
 
 #include <glm/gtx/norm.hpp>
 
-void Player::Controls::send_controls_message(Connection *connection_) const {
-	assert(connection_);
-	auto &connection = *connection_;
-
-	uint32_t size = 5;
-	connection.send(Message::C2S_Controls);
-	connection.send(uint8_t(size));
-	connection.send(uint8_t(size >> 8));
-	connection.send(uint8_t(size >> 16));
-
-	auto send_button = [&](Button const &b) {
-		if (b.downs & 0x80) {
-			std::cerr << "Wow, you are really good at pressing buttons!" << std::endl;
-		}
-		connection.send(uint8_t( (b.pressed ? 0x80 : 0x00) | (b.downs & 0x7f) ) );
-	};
-
-	send_button(left);
-	send_button(right);
-	send_button(up);
-	send_button(down);
-	send_button(jump);
-}
-
-bool Player::Controls::recv_controls_message(Connection *connection_) {
+bool InputTimeline::recv_controls_message(Connection *connection_, ControlsMessage *message_) {
 	assert(connection_);
+	assert(message_);
+	auto &message = *message_;
 	auto &connection = *connection_;
 
 	auto &recv_buffer = connection.recv_buffer;
@@ -45,14 +29,76 @@ bool Player::Controls::recv_controls_message(Connection *connection_) {
 	uint32_t size = (uint32_t(recv_buffer[3]) << 16)
 	              | (uint32_t(recv_buffer[2]) << 8)
 	              |  uint32_t(recv_buffer[1]);
-	if (size != 5) throw std::runtime_error("Controls message with size " + std::to_string(size) + " != 5!");
-	
+	//[client tick u32][count u8] + count * [ticks before client tick u8][5 buttons]:
+	if (size < 5 || size > 5 + 6 * Game::InputRedundancy || (size - 5) % 6 != 0) {
+		throw std::runtime_error("Controls message with size " + std::to_string(size) + "!");
+	}
+
 	//expecting complete message:
 	if (recv_buffer.size() < 4 + size) return false;
 
+	std::memcpy(&message.tick, &recv_buffer[4], sizeof(message.tick));
+	message.count = recv_buffer[8];
+	if (size != 5 + 6 * message.count) throw std::runtime_error("Controls message with " + std::to_string(message.count) + " inputs in " + std::to_string(size) + " bytes!");
+
 	auto recv_button = [](uint8_t byte, Button *button) {
 		button->pressed = (byte & 0x80);
-		uint32_t d = uint32_t(button->downs) + uint32_t(byte & 0x7f);
+		button->downs = (byte & 0x7f);
+	};
+
+	for (uint32_t i = 0; i < message.count; ++i) {
+		uint8_t const *at = &recv_buffer[9 + 6 * i];
+		Player::Input &input = message.inputs[i];
+		input.seq = message.tick - at[0];
+		recv_button(at[1+0], &input.controls.left);
+		recv_button(at[1+1], &input.controls.right);
+		recv_button(at[1+2], &input.controls.up);
+		recv_button(at[1+3], &input.controls.down);
+		recv_button(at[1+4], &input.controls.jump);
+	}
+
+	//delete message from buffer:
+	recv_buffer.consume(4 + size);
+
+	return true;
+}
+
+bool InputTimeline::recv_controls_message(Connection *connection) {
+	ControlsMessage message;
+	if (!recv_controls_message(connection, &message)) return false;
+	receive(message);
+	return true;
+}
+
+void InputTimeline::receive(ControlsMessage const &message) {
+	//line the timeline up with the client's tick on the first message and whenever it has drifted too far:
+	// (the message went out on 'tick', so its inputs are due by the next update)
+	int32_t lead = int32_t(message.tick - applied);
+	if (!synced || lead > MaxLead || lead < -1) {
+		applied = message.tick - 1;
+		synced = true;
+	}
+
+	for (uint32_t i = 0; i < message.count; ++i) {
+		Player::Input const &input = message.inputs[i];
+		//(inputs are repeated in later messages; only new ones matter)
+		if (newest != 0 && int32_t(input.seq - newest) <= 0) continue;
+		if (int32_t(input.seq - applied) <= 0) late += 1;
+		queued.emplace_back(input);
+		newest = input.seq;
+	}
+}
+
+void InputTimeline::advance(Player::Controls *controls_) {
+	assert(controls_);
+	auto &controls = *controls_;
+	if (!synced) return;
+
+	applied += 1;
+
+	auto fold_button = [](Button const &in, Button *button) {
+		button->pressed = in.pressed;
+		uint32_t d = uint32_t(button->downs) + uint32_t(in.downs);
 		if (d > 255) {
 			std::cerr << "got a whole lot of downs" << std::endl;
 			d = 255;
@@ -60,303 +106,1357 @@ bool Player::Controls::recv_controls_message(Connection *connection_) {
 		button->downs = uint8_t(d);
 	};
 
-	recv_button(recv_buffer[4+0], &left);
-	recv_button(recv_buffer[4+1], &right);
-	recv_button(recv_buffer[4+2], &up);
-	recv_button(recv_buffer[4+3], &down);
-	recv_button(recv_buffer[4+4], &jump);
+	//inputs hold until the next one, so only the ones due now (or late) change anything:
+	while (!queued.empty() && int32_t(queued.front().seq - applied) <= 0) {
+		Player::Controls const &in = queued.front().controls;
+		fold_button(in.left, &controls.left);
+		fold_button(in.right, &controls.right);
+		fold_button(in.up, &controls.up);
+		fold_button(in.down, &controls.down);
+		fold_button(in.jump, &controls.jump);
+		queued.pop_front();
+	}
+}
 
-	//delete message from buffer:
-	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
 
-	return true;
+//-----------------------------------------
+
+void SnakeBody::push_head(glm::ivec3 const &head) {
+	if (count == ring.size()) {
+		//full: unroll into a buffer twice the size (tail back at index 0):
+		std::vector< glm::ivec3 > grown(std::max< size_t >(4, ring.size() * 2));
+		for (uint32_t i = 0; i < count; ++i) {
+			grown[i] = (*this)[i];
+		}
+		ring = std::move(grown);
+		tail = 0;
+	}
+	ring[(tail + count) & (ring.size() - 1)] = head;
+	count += 1;
+}
+
+glm::ivec3 SnakeBody::advance(glm::ivec3 const &head) {
+	assert(count > 0);
+	glm::ivec3 old_tail = ring[tail];
+	//the slot after the current head is the tail itself when the ring is full:
+	ring[(tail + count) & (ring.size() - 1)] = head;
+	tail = (tail + 1) & uint32_t(ring.size() - 1);
+	return old_tail;
+}
+
+SnakeBody::Span SnakeBody::first_span() const {
+	Span span;
+	if (count == 0) return span;
+	span.data = ring.data() + tail;
+	span.size = std::min< size_t >(count, ring.size() - tail);
+	return span;
 }
 
+SnakeBody::Span SnakeBody::second_span() const {
+	Span span;
+	if (count == 0) return span;
+	span.data = ring.data();
+	span.size = count - first_span().size;
+	return span;
+}
 
 //-----------------------------------------
 
+Map::Map() {
+	resize(10, 10);
+}
 
-bool Game::spawnApples(uint32_t applesToPlace) {
-	std::list<glm::ivec2> valid_apple_spawns = valid_spawn_positions();
+void Map::resize(uint32_t width_, uint32_t height_) {
+	width = width_;
+	height = height_;
+	chunks_x = (width + ChunkSize - 1) / ChunkSize;
+	chunks_y = (height + ChunkSize - 1) / ChunkSize;
+	chunks.clear();
+	chunks.resize(size_t(chunks_x) * size_t(chunks_y));
+}
+
+void Map::set(int x, int y, MapBlock block) {
+	assert(x >= 0 && uint32_t(x) < width && y >= 0 && uint32_t(y) < height);
+	if (block == G && !chunks[(uint32_t(y) / ChunkSize) * chunks_x + (uint32_t(x) / ChunkSize)]) return; //(already ground)
+	Chunk &chunk = edit_chunk(uint32_t(x) / ChunkSize, uint32_t(y) / ChunkSize);
+	MapBlock &at = chunk.blocks[(uint32_t(y) % ChunkSize) * ChunkSize + (uint32_t(x) % ChunkSize)];
+	chunk.ground += uint32_t(block == G) - uint32_t(at == G);
+	at = block;
+}
 
+Map::Chunk &Map::edit_chunk(uint32_t cx, uint32_t cy) {
+	assert(cx < chunks_x && cy < chunks_y);
+	std::shared_ptr< Chunk > &chunk = chunks[cy * chunks_x + cx];
+	if (!chunk) {
+		chunk = std::make_shared< Chunk >();
+		std::fill(chunk->blocks, chunk->blocks + ChunkSize * ChunkSize, G);
+		glm::uvec2 extent = chunk_extent(cx, cy);
+		chunk->ground = extent.x * extent.y;
+	} else if (chunk.use_count() > 1) {
+		chunk = std::make_shared< Chunk >(*chunk); //(copy on write)
+	}
+	return *chunk;
+}
+
+void Map::count_ground(uint32_t cx, uint32_t cy) {
+	Chunk *chunk = chunks[cy * chunks_x + cx].get();
+	if (!chunk) return;
+	glm::uvec2 extent = chunk_extent(cx, cy);
+	chunk->ground = 0;
+	for (uint32_t y = 0; y < extent.y; ++y) {
+		for (uint32_t x = 0; x < extent.x; ++x) {
+			if (chunk->blocks[y * ChunkSize + x] == G) chunk->ground += 1;
+		}
+	}
+}
+
+void Map::load(std::string const &filename) {
+	std::ifstream file(filename, std::ios::binary);
+	if (!file) throw std::runtime_error("Failed to open map '" + filename + "'.");
+
+	std::vector< std::string > rows;
+	std::string line;
+	while (std::getline(file, line)) {
+		if (!line.empty() && line.back() == '\r') line.pop_back();
+		if (line.empty()) continue;
+		if (!rows.empty() && line.size() != rows[0].size()) {
+			throw std::runtime_error("Map '" + filename + "' row " + std::to_string(rows.size()) + " has " + std::to_string(line.size()) + " blocks, expected " + std::to_string(rows[0].size()) + ".");
+		}
+		rows.emplace_back(line);
+		if (rows.size() > MaxSize) break;
+	}
+	if (rows.empty()) throw std::runtime_error("Map '" + filename + "' is empty.");
+	if (rows.size() > MaxSize || rows[0].size() > MaxSize) {
+		throw std::runtime_error("Map '" + filename + "' is larger than " + std::to_string(MaxSize) + "x" + std::to_string(MaxSize) + ".");
+	}
+
+	resize(uint32_t(rows[0].size()), uint32_t(rows.size()));
+	for (uint32_t y = 0; y < height; ++y) {
+		std::string const &row = rows[height - 1 - y]; //first line is the top row
+		for (uint32_t x = 0; x < width; ++x) {
+			char c = row[x];
+			MapBlock block;
+			if (c == '.') block = G;
+			else if (c == '#') block = B;
+			else if (c >= '0' && c <= '7') block = MapBlock(c - '0');
+			else throw std::runtime_error("Map '" + filename + "' has unknown block '" + std::string(1, c) + "'.");
+			set(int(x), int(y), block);
+		}
+	}
+}
+
+void Map::save(std::string const &filename) const {
+	std::ofstream file(filename, std::ios::binary);
+	if (!file) throw std::runtime_error("Failed to open map '" + filename + "' for writing.");
+
+	std::string row(width, '.');
+	for (uint32_t y = height; y > 0; --y) { //first line is the top row
+		for (uint32_t x = 0; x < width; ++x) {
+			MapBlock block = grid_idx(int(x), int(y - 1));
+			row[x] = (block == G ? '.' : block == B ? '#' : char('0' + block));
+		}
+		file << row << '\n';
+	}
+	if (!file) throw std::runtime_error("Failed to write map '" + filename + "'.");
+}
+
+uint64_t Map::hash() const {
+	//64-bit FNV-1a over size, then blocks a chunk at a time (so all-ground chunks don't need their blocks looked up):
+	uint64_t h = 0xcbf29ce484222325ull;
+	auto add = [&h](uint8_t byte) {
+		h = (h ^ byte) * 0x100000001b3ull;
+	};
+	for (uint32_t v : { width, height }) {
+		for (uint32_t i = 0; i < 4; ++i) add(uint8_t(v >> (8 * i)));
+	}
+	for (auto const &chunk : chunks) {
+		for (uint32_t i = 0; i < ChunkSize * ChunkSize; ++i) {
+			add(chunk ? chunk->blocks[i] : G);
+		}
+	}
+	return h;
+}
+
+//-----------------------------------------
+
+void Occupancy::resize(Map const &map) {
+	width = int32_t(map.width);
+	height = int32_t(map.height);
+	chunks_x = map.chunks_x;
+	chunks.clear();
+	chunks.resize(map.chunks.size());
+	overflow.clear();
+	touched.clear();
+}
+
+void Occupancy::clear() {
+	for (uint32_t *count : touched) {
+		*count = 0;
+	}
+	touched.clear();
+	overflow.clear();
+}
+
+void Occupancy::add(glm::ivec3 const &cell) {
+	if (cell.x < 0 || cell.x >= width || cell.y < 0 || cell.y >= height || cell.z < 0 || cell.z >= Layers) {
+		overflow[cell] += 1;
+		return;
+	}
+	std::unique_ptr< Chunk > &chunk = chunks[(uint32_t(cell.y) / Map::ChunkSize) * chunks_x + (uint32_t(cell.x) / Map::ChunkSize)];
+	if (!chunk) chunk.reset(new Chunk);
+	uint32_t &count = chunk->counts[(uint32_t(cell.z) * Map::ChunkSize + (uint32_t(cell.y) % Map::ChunkSize)) * Map::ChunkSize + (uint32_t(cell.x) % Map::ChunkSize)];
+	if (count == 0) touched.emplace_back(&count);
+	count += 1;
+}
+
+uint32_t Occupancy::count(glm::ivec3 const &cell) const {
+	if (cell.x < 0 || cell.x >= width || cell.y < 0 || cell.y >= height || cell.z < 0 || cell.z >= Layers) {
+		auto f = overflow.find(cell);
+		return (f == overflow.end() ? 0 : f->second);
+	}
+	Chunk const *chunk = chunks[(uint32_t(cell.y) / Map::ChunkSize) * chunks_x + (uint32_t(cell.x) / Map::ChunkSize)].get();
+	if (!chunk) return 0;
+	return chunk->counts[(uint32_t(cell.z) * Map::ChunkSize + (uint32_t(cell.y) % Map::ChunkSize)) * Map::ChunkSize + (uint32_t(cell.x) % Map::ChunkSize)];
+}
+
+//-----------------------------------------
+
+void FreeCells::reset(Map const &map_) {
+	map = &map_;
+	width = int32_t(map->width);
+	height = int32_t(map->height);
+	chunks.clear();
+	chunks.resize(map->chunks.size());
+
+	//every ground block is free (counted per chunk, so no blocks are looked at):
+	tree.assign(chunks.size() + 1, 0);
+	total = 0;
+	for (uint32_t c = 0; c < chunks.size(); ++c) {
+		Map::Chunk const *map_chunk = map->chunks[c].get();
+		glm::uvec2 extent = map->chunk_extent(c % map->chunks_x, c / map->chunks_x);
+		uint32_t count = (map_chunk ? map_chunk->ground : extent.x * extent.y);
+		tree[c + 1] += count;
+		total += count;
+	}
+	//(turn per-chunk counts into a Fenwick tree in place)
+	for (size_t i = 1; i < tree.size(); ++i) {
+		size_t parent = i + (i & (~i + 1));
+		if (parent < tree.size()) tree[parent] += tree[i];
+	}
+}
+
+void FreeCells::add_count(uint32_t chunk, int32_t delta) {
+	total += uint32_t(delta);
+	for (size_t i = chunk + 1; i < tree.size(); i += (i & (~i + 1))) {
+		tree[i] += uint32_t(delta);
+	}
+}
+
+FreeCells::Chunk &FreeCells::list_chunk(uint32_t c) {
+	std::unique_ptr< Chunk > &chunk = chunks[c];
+	if (chunk) return *chunk;
+	chunk.reset(new Chunk);
+	std::fill(chunk->slot, chunk->slot + Map::ChunkSize * Map::ChunkSize, NotFree);
+	std::fill(chunk->blockers, chunk->blockers + Map::ChunkSize * Map::ChunkSize, 0);
+	Map::Chunk const *map_chunk = map->chunks[c].get();
+	glm::uvec2 extent = map->chunk_extent(c % map->chunks_x, c / map->chunks_x);
+	chunk->cells.reserve(extent.x * extent.y); //(so unblocking never grows it)
+	for (uint32_t y = 0; y < extent.y; ++y) {
+		for (uint32_t x = 0; x < extent.x; ++x) {
+			uint16_t i = uint16_t(y * Map::ChunkSize + x);
+			if (map_chunk && map_chunk->blocks[i] != G) continue;
+			chunk->slot[i] = uint16_t(chunk->cells.size());
+			chunk->cells.emplace_back(i);
+		}
+	}
+	return *chunk;
+}
+
+void FreeCells::block(glm::ivec3 const &cell) {
+	if (cell.x < 0 || cell.x >= width || cell.y < 0 || cell.y >= height) return;
+	uint32_t c = (uint32_t(cell.y) / Map::ChunkSize) * map->chunks_x + (uint32_t(cell.x) / Map::ChunkSize);
+	Chunk &chunk = list_chunk(c);
+	uint16_t i = uint16_t((uint32_t(cell.y) % Map::ChunkSize) * Map::ChunkSize + (uint32_t(cell.x) % Map::ChunkSize));
+	assert(chunk.blockers[i] < 0xffff);
+	if (++chunk.blockers[i] != 1) return; //(already blocked)
+	if (chunk.slot[i] == NotFree) return; //(barrier, so never free)
+
+	//swap-remove from the chunk's list:
+	uint16_t moved = chunk.cells.back();
+	chunk.cells[chunk.slot[i]] = moved;
+	chunk.slot[moved] = chunk.slot[i];
+	chunk.cells.pop_back();
+	chunk.slot[i] = NotFree;
+	add_count(c, -1);
+}
+
+void FreeCells::unblock(glm::ivec3 const &cell) {
+	if (cell.x < 0 || cell.x >= width || cell.y < 0 || cell.y >= height) return;
+	//(the chunk was listed when this cell was blocked)
+	uint32_t c = (uint32_t(cell.y) / Map::ChunkSize) * map->chunks_x + (uint32_t(cell.x) / Map::ChunkSize);
+	assert(chunks[c]);
+	Chunk &chunk = *chunks[c];
+	uint16_t i = uint16_t((uint32_t(cell.y) % Map::ChunkSize) * Map::ChunkSize + (uint32_t(cell.x) % Map::ChunkSize));
+	assert(chunk.blockers[i] > 0);
+	if (--chunk.blockers[i] != 0) return;
+	if (map->grid_idx(cell.x, cell.y) != G) return; //(barrier, so never free)
+
+	chunk.slot[i] = uint16_t(chunk.cells.size());
+	chunk.cells.emplace_back(i);
+	add_count(c, 1);
+}
+
+glm::ivec2 FreeCells::operator[](size_t index) const {
+	assert(index < total);
+	//find the chunk holding the index'th free cell by walking down the Fenwick tree:
+	uint32_t i = uint32_t(index);
+	size_t c = 0;
+	size_t step = 1;
+	while (step * 2 < tree.size()) step *= 2;
+	for (; step > 0; step /= 2) {
+		if (c + step < tree.size() && tree[c + step] <= i) {
+			c += step;
+			i -= tree[c];
+		}
+	}
+	assert(c < chunks.size());
+	glm::ivec2 origin = glm::ivec2(int32_t(c % map->chunks_x), int32_t(c / map->chunks_x)) * int32_t(Map::ChunkSize);
+
+	if (Chunk const *chunk = chunks[c].get()) {
+		uint16_t at = chunk->cells[i];
+		return origin + glm::ivec2(int32_t(at % Map::ChunkSize), int32_t(at / Map::ChunkSize));
+	}
+	//nothing blocked in this chunk, so the i'th free cell is its i'th ground block:
+	glm::uvec2 extent = map->chunk_extent(uint32_t(c % map->chunks_x), uint32_t(c / map->chunks_x));
+	Map::Chunk const *map_chunk = map->chunks[c].get();
+	if (!map_chunk) return origin + glm::ivec2(int32_t(i % extent.x), int32_t(i / extent.x));
+	for (uint32_t y = 0; y < extent.y; ++y) {
+		for (uint32_t x = 0; x < extent.x; ++x) {
+			if (map_chunk->blocks[y * Map::ChunkSize + x] != G) continue;
+			if (i == 0) return origin + glm::ivec2(int32_t(x), int32_t(y));
+			i -= 1;
+		}
+	}
+	assert(false && "free count doesn't match chunk's ground blocks");
+	return origin;
+}
+
+//-----------------------------------------
+
+void Game::add_apple(Apple const &apple) {
+	assert(apple_at.count(apple.position) == 0);
+	apple_at.emplace(apple.position, uint32_t(apples.size()));
+	apples.emplace_back(apple);
+	free_cells.block(apple.position);
+}
+
+void Game::remove_apple(uint32_t index) {
+	assert(index < apples.size());
+	free_cells.unblock(apples[index].position);
+	apple_at.erase(apples[index].position);
+	if (index + 1 != apples.size()) {
+		apples[index] = apples.back();
+		apple_at[apples[index].position] = index;
+	}
+	apples.pop_back();
+}
+
+bool Game::spawnApples(uint32_t applesToPlace) {
 	if(applesToPlace > 1) {
 		
 
-		for(uint32_t i = 0; (i < applesToPlace) && (valid_apple_spawns.size() > 0); i++) {
-			uint32_t idx = mt() % valid_apple_spawns.size();
-			auto new_it = valid_apple_spawns.begin();
-			std::advance(new_it, idx);
-			glm::ivec2 new_pos = *new_it;
-			apples.emplace_back(glm::ivec3(new_pos.x, new_pos.y, 0), Normal);
-			valid_apple_spawns.erase(new_it);
+		for(uint32_t i = 0; (i < applesToPlace) && (free_cells.size() > 0); i++) {
+			uint32_t idx = mt() % free_cells.size();
+			glm::ivec2 new_pos = free_cells[idx];
+			add_apple(Apple(glm::ivec3(new_pos.x, new_pos.y, 0), Normal)); //(removes new_pos from free_cells)
 		}
 
 	}
 
-	if(valid_apple_spawns.size() == 0) {
+	if(free_cells.size() == 0) {
 			return false;
 	}
 	return true;
 }
 
 Game::Game() : mt(0x15466666) {
+	map_hash = map.hash();
+	occupancy.resize(map);
+	free_cells.reset(map);
+
 	//spawn first apple
 	spawnApples(1);
 
 }
 
-Player *Game::spawn_player() {
-	players.emplace_back();
-	Player &player = players.back();
+Player::Handle Players::add() {
+	Player::Handle ret;
+	if (!free_indices.empty()) {
+		ret.index = free_indices.back();
+		free_indices.pop_back();
+	} else {
+		ret.index = uint32_t(slot_of.size());
+		slot_of.emplace_back(0);
+		generation_of.emplace_back(0);
+	}
+	ret.generation = generation_of[ret.index];
+	slot_of[ret.index] = uint32_t(size());
+
+	head.emplace_back(0, 0, 0);
+	zHeight.emplace_back(Player::DefaultZHeight);
+	jumpVelocity.emplace_back(Player::DefaultJumpVelocity);
+	next_move_timer.emplace_back(1.0f / Player::DefaultVelocity);
+	velocity.emplace_back(Player::DefaultVelocity);
+	move_dir.emplace_back(right);
+	alive.emplace_back(1);
+	controls.emplace_back();
+	body.emplace_back();
+	color.emplace_back(1.0f, 1.0f, 1.0f);
+	name.emplace_back("");
+	handle.emplace_back(ret);
+
+	return ret;
+}
+
+void Players::remove(Player::Handle h) {
+	assert(valid(h));
+	uint32_t i = slot_of[h.index];
+	uint32_t last = uint32_t(size() - 1);
+
+	//move the last player into the vacated slot:
+	if (i != last) {
+		head[i] = head[last];
+		zHeight[i] = zHeight[last];
+		jumpVelocity[i] = jumpVelocity[last];
+		next_move_timer[i] = next_move_timer[last];
+		velocity[i] = velocity[last];
+		move_dir[i] = move_dir[last];
+		alive[i] = alive[last];
+		controls[i] = controls[last];
+		body[i] = std::move(body[last]);
+		color[i] = color[last];
+		name[i] = std::move(name[last]);
+		handle[i] = handle[last];
+		slot_of[handle[i].index] = i;
+	}
+	head.pop_back();
+	zHeight.pop_back();
+	jumpVelocity.pop_back();
+	next_move_timer.pop_back();
+	velocity.pop_back();
+	move_dir.pop_back();
+	alive.pop_back();
+	controls.pop_back();
+	body.pop_back();
+	color.pop_back();
+	name.pop_back();
+	handle.pop_back();
+
+	//retire the handle:
+	generation_of[h.index] += 1;
+	free_indices.emplace_back(h.index);
+}
+
+void Players::clear() {
+	while (size()) remove(handle.back());
+}
+
+bool Players::valid(Player::Handle h) const {
+	return h.index < generation_of.size() && generation_of[h.index] == h.generation;
+}
+
+uint32_t Players::slot(Player::Handle h) const {
+	assert(valid(h));
+	return slot_of[h.index];
+}
+
+//-----------------------------------------
+
+void Game::set_map(Map const &new_map, uint64_t new_map_hash) {
+	assert(players.size() == 0 && "set_map should be called before players join");
+	map = new_map; //(shares new_map's chunks)
+	map_hash = new_map_hash;
+	occupancy.resize(map);
+	free_cells.reset(map);
+	apples.clear();
+	apple_at.clear();
+}
 
-	//random point in the middle area of the arena:
-	player.block_positions.emplace_back(glm::ivec3(0, 0, 0));
+Player::Handle Game::spawn_player() {
+	Player::Handle handle = players.add();
+	uint32_t i = players.slot(handle);
 
-	std::list<glm::ivec2> spawn_positions = valid_spawn_positions();
-	glm::ivec2 spawn_pos;
-	if(spawn_positions.size() > 0) {
-		auto it = spawn_positions.begin();
-		std::advance(it, mt() % spawn_positions.size());
-		spawn_pos = *it;
+	//random free point in the arena:
+	glm::ivec2 spawn_pos = glm::ivec2(0, 0);
+	if(free_cells.size() > 0) {
+		spawn_pos = free_cells[mt() % free_cells.size()];
 	}
-	//glm::ivec2 spawn_pos = spawn_positions.size() > 0 ? *std::advance(spawn_positions.begin(), mt() % valid_spawn_positions.size()) : spawn_pos;
-	player.block_positions[player.block_positions.size() - 1] = glm::ivec3(spawn_pos.x, spawn_pos.y, 0);
+	players.body[i].push_head(glm::ivec3(spawn_pos.x, spawn_pos.y, 0));
+	players.head[i] = players.body[i].back();
+	block_snake_cell(players.head[i]);
 
 
+	glm::vec3 &color = players.color[i];
 	do {
-		player.color.r = mt() / float(mt.max());
-		player.color.g = mt() / float(mt.max());
-		player.color.b = mt() / float(mt.max());
-	} while (player.color == glm::vec3(0.0f));
-	player.color = glm::normalize(player.color);
+		color.r = mt() / float(mt.max());
+		color.g = mt() / float(mt.max());
+		color.b = mt() / float(mt.max());
+	} while (color == glm::vec3(0.0f));
+	color = glm::normalize(color);
 
-	player.name = "Player " + std::to_string(next_player_number++);
+	players.name[i] = "Player " + std::to_string(next_player_number++);
 
-	return &player;
+	return handle;
 }
 
-void Game::remove_player(Player *player) {
-	bool found = false;
-	for (auto pi = players.begin(); pi != players.end(); ++pi) {
-		if (&*pi == player) {
-			players.erase(pi);
-			found = true;
-			break;
-		}
+void Game::remove_player(Player::Handle handle) {
+	assert(players.valid(handle));
+	for (auto const &block : players.body[players.slot(handle)]) {
+		unblock_snake_cell(block);
 	}
-	assert(found);
+	players.remove(handle);
 }
 
-std::list<glm::ivec2> Game::valid_spawn_positions() {
-	std::list<glm::ivec2> valid_spawns;
-	for(int y = 0; y < map.height; y++) {
-			for(int x = 0; x < map.width; x++) {
-				if(map.grid_idx(x, y) == G) {
-					valid_spawns.emplace_back(glm::ivec2(x, y));
+Game::Move Game::plan_move(uint32_t i, float elapsed) {
+	Player::Controls &controls = players.controls[i];
+	SnakeBody const &body = players.body[i];
+	float &zHeight = players.zHeight[i];
+	float &jumpVelocity = players.jumpVelocity[i];
+	float &next_move_timer = players.next_move_timer[i];
+	float velocity = players.velocity[i];
+
+	auto move_valid = [&](Direction move_dir) {
+		if(body.size() <= 1) return true;
+		glm::ivec3 h_pos = players.head[i];
+		glm::ivec3 n_pos = body[body.size() - 2];
+		if(move_dir == right && ((h_pos.x == (map.width-1) && n_pos.x != 0) || (n_pos.x <= h_pos.x))) return true;
+		if(move_dir == left && ((h_pos.x == 0 && n_pos.x != (map.width-1)) || (n_pos.x >= h_pos.x))) return true;
+		if(move_dir == up && ((h_pos.y == (map.height-1) && n_pos.y != 0) || (n_pos.y <= h_pos.y))) return true;
+		if(move_dir == down && ((h_pos.y == 0 && n_pos.y != (map.height-1)) || (n_pos.y <= h_pos.y))) return true;
+		return false;
+	};
+
+
+
+	glm::ivec3 vel = glm::ivec3(0, 0, 0);
+	if (controls.left.pressed && move_valid(left)) {
+		vel = glm::ivec3(-1, 0, 0);
+		players.move_dir[i] = left;
+	}
+	else if (controls.right.pressed && move_valid(right)) {
+		vel = glm::ivec3(1, 0, 0);
+		players.move_dir[i] = right;
+	}
+	else if (controls.down.pressed && move_valid(down)) {
+		vel = glm::ivec3(0, -1, 0);
+		players.move_dir[i] = down;
+	}
+	else if (controls.up.pressed && move_valid(up)) {
+		vel = glm::ivec3(0, 1, 0);
+		players.move_dir[i] = up;
+	}
+
+	if(controls.jump.pressed) {
+		jumpVelocity = 3.0f*velocity;
+	} else {
+		static constexpr float gravity = 5.0f;
+		jumpVelocity -= gravity*elapsed;
+	}
+
+	zHeight += jumpVelocity*elapsed;
+	if(zHeight <= 0.5f) {
+		zHeight = 0.5f;
+		jumpVelocity = 0.0f;
+	}
+
+	//each step moves the head by 'vel' and puts it in the current z layer:
+	Move move;
+	move.vel = vel;
+	move.z = (int32_t)std::floor(zHeight);
+	move.steps = 0;
+
+	next_move_timer -= elapsed;
+	while(next_move_timer < 0) {
+		next_move_timer += (1.0f / velocity);
+		move.steps += 1;
+	}
+
+
+	//reset 'downs' since controls have been handled:
+	controls.left.downs = 0;
+	controls.right.downs = 0;
+	controls.up.downs = 0;
+	controls.down.downs = 0;
+	controls.jump.downs = 0;
+
+	return move;
+}
+
+void Game::predict_player(uint32_t i, float elapsed) {
+	Move move = plan_move(i, elapsed);
+	SnakeBody &body = players.body[i];
+	for (uint32_t step = 0; step < move.steps; ++step) {
+		glm::ivec3 new_head_pos = move.next_head(players.head[i]);
+		//(guess that an apple there gets eaten; the server's next state settles it)
+		if (apple_at.count(new_head_pos)) body.push_head(new_head_pos);
+		else body.advance(new_head_pos);
+		players.head[i] = new_head_pos;
+	}
+}
+
+void Game::update(float elapsed) {
+	//The update runs in phases so that the per-player work can be split across 'workers':
+	// 1) (parallel) controls, jump, and move timer for each player -> how far its head moves this tick
+	// 2) (serial, in slot order) apply those moves: apple claims, body updates, free cells
+	// 3) (serial) occupancy grid from every snake block
+	// 4) (parallel) per-head collision lookups
+	//Parallel phases only write to their own player's slots, and everything shared happens in
+	// slot order in the serial phases, so the result doesn't depend on the number of workers.
+	PROFILE_SCOPE("game.update");
+
+	tick += 1;
+
+	moves.resize(players.size());
+
+	//position/velocity update:
+	auto plan_moves = [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i) {
+			moves[i] = plan_move(i, elapsed);
+		}
+	};
+	{ PROFILE_SCOPE("game.update.movement");
+		if (workers) workers->parallel_for(uint32_t(players.size()), plan_moves);
+		else plan_moves(0, uint32_t(players.size()));
+	}
+
+	//apply moves:
+	// (in slot order, so when two heads reach the same apple the lower slot gets it -- same as a serial update)
+	int32_t applesToPlace = 0;
+	{ PROFILE_SCOPE("game.update.apply_moves");
+		for (uint32_t i = 0; i < players.size(); ++i) {
+			Move const &move = moves[i];
+			SnakeBody &body = players.body[i];
+			for (uint32_t step = 0; step < move.steps; ++step) {
+				glm::ivec3 new_head_pos = move.next_head(players.head[i]);
+
+				//check for collision with apples
+				bool hit_apple = false;
+				auto f = apple_at.find(new_head_pos);
+				if (f != apple_at.end()) {
+					hit_apple = true;
+					applesToPlace++;
+					remove_apple(f->second);
 				}
+
+				if(hit_apple) {
+					body.push_head(new_head_pos);
+				} else {
+					//upadte block positions (tail slot becomes the new head)
+					unblock_snake_cell(body.advance(new_head_pos));
+				}
+				block_snake_cell(new_head_pos);
+				players.head[i] = new_head_pos;
 			}
 		}
+	}
 
-		for (auto &p1 : players) {
-			for(auto block : p1.block_positions) {
-				if (block.z > 0) continue;
-				valid_spawns.remove(glm::ivec2(block.x, block.y));
+	//collision resolution:
+	//(every snake block goes into the occupancy grid, so each head check is a single lookup)
+	{ PROFILE_SCOPE("game.update.occupancy");
+		occupancy.clear();
+		for (auto const &body : players.body) {
+			for (auto const &block : body) {
+				occupancy.add(block);
 			}
 		}
+	}
+
+	auto check_collisions = [&](uint32_t begin, uint32_t end) {
+		for (uint32_t i = begin; i < end; ++i) {
+			glm::ivec3 head_pos = players.head[i];
+			//head / player collisions:
+			//n.b. this player's own head is counted too -- same as the old all-pairs loop, which compared against every block of every player
+			if (occupancy.count(head_pos) > 0) {
+				//kill player !
+				players.alive[i] = 0;
+			}
 
-		for (auto &a : apples) {
-			valid_spawns.remove(glm::ivec2(a.position.x, a.position.y));
+			//player grid collisions (heads that have left the map have nothing to hit)
+			if (head_pos.x >= 0 && head_pos.x < int32_t(map.width) && head_pos.y >= 0 && head_pos.y < int32_t(map.height)
+			 && map.grid_idx(head_pos.x, head_pos.y) == B) {
+				players.alive[i] = 0;
+			}
 		}
+	};
+	{ PROFILE_SCOPE("game.update.collisions");
+		if (workers) workers->parallel_for(uint32_t(players.size()), check_collisions);
+		else check_collisions(0, uint32_t(players.size()));
+	}
+
+	PROFILE_SCOPE("game.update.spawning");
+	bool gamePlaying = spawnApples(applesToPlace);
+	if(gamePlaying) return;
 
-	return valid_spawns;
 }
 
 
-void Game::update(float elapsed) {
-	//position/velocity update:
-	int32_t applesToPlace = 0;
-	for (auto &p : players) {
-
-		auto move_valid = [&](Direction move_dir) {
-			if(p.block_positions.size() <= 1) return true;
-			glm::ivec3 h_pos = p.block_positions.back();
-			glm::ivec3 n_pos = *std::prev(p.block_positions.end(), 2);
-			if(move_dir == right && ((h_pos.x == (map.width-1) && n_pos.x != 0) || (n_pos.x <= h_pos.x))) return true;
-			if(move_dir == left && ((h_pos.x == 0 && n_pos.x != (map.width-1)) || (n_pos.x >= h_pos.x))) return true;
-			if(move_dir == up && ((h_pos.y == (map.height-1) && n_pos.y != 0) || (n_pos.y <= h_pos.y))) return true;
-			if(move_dir == down && ((h_pos.y == 0 && n_pos.y != (map.height-1)) || (n_pos.y <= h_pos.y))) return true;
-			return false;
-		};
+void Game::record_snapshot() {
+	Snapshot snapshot;
+	snapshot.tick = tick;
+	snapshot.apples = apples;
+	snapshot.players.resize(players.size());
+	for (uint32_t i = 0; i < players.size(); ++i) {
+		Snapshot::PlayerState &player = snapshot.players[i];
+		player.handle = players.handle[i];
+		player.color = players.color[i];
+		player.move_dir = players.move_dir[i];
+		player.zHeight = players.zHeight[i];
+		player.alive = players.alive[i];
+		SnakeBody::Span first = players.body[i].first_span();
+		SnakeBody::Span second = players.body[i].second_span();
+		player.body.reserve(first.size + second.size);
+		player.body.insert(player.body.end(), first.data, first.data + first.size);
+		player.body.insert(player.body.end(), second.data, second.data + second.size);
+		player.name = players.name[i];
+	}
 
+	if (!history.empty() && history.back().tick == tick) history.pop_back(); //(re-recording the same tick)
+	history.emplace_back(std::move(snapshot));
+	while (history.size() > HistoryTicks) history.pop_front();
+}
 
+Snapshot const *Game::snapshot_at(uint32_t at) const {
+	if (at == NoTick) return nullptr;
+	for (auto const &snapshot : history) {
+		if (snapshot.tick == at) return &snapshot;
+	}
+	return nullptr;
+}
 
-		glm::ivec3 vel = glm::ivec3(0, 0, 0);
-		if (p.controls.left.pressed && move_valid(left)) {
-			vel = glm::ivec3(-1, 0, 0);
-			p.move_dir = left;
-		}
-		else if (p.controls.right.pressed && move_valid(right)) {
-			vel = glm::ivec3(1, 0, 0);
-			p.move_dir = right;
+//State messages describe a snapshot relative to a baseline snapshot the client already has
+// (or relative to nothing, for a whole state):
+//  [S2C_State][size:3][tick:4][baseline tick:4 (NoTick => whole state)][map hash:8]
+//  [apples changed:1] if changed: [count:4][apples]
+//  [player count:varint] then per player, in slot order:
+//    [flags:1] (StateNew: [color][name len:1][name]) else: [baseline index:varint]
+//    (StateMoveDir: [move_dir:1]) (StateZHeight: [zHeight:4]) (StateAlive: [alive:1])
+//    (StateBodyFull: [length:varint][steps from (0,0,0)])
+//    (StateBodyStep: [tail blocks dropped:varint][head blocks added:varint][steps from the last kept block, or (0,0,0)])
+//  (bodies are packed as BodyCodec steps -- mostly 3 bits per block -- rather than 12-byte ivec3s)
+//  players not in the baseline, or whose color or name changed, are sent as StateNew (with StateBodyFull).
+enum StateFlags : uint8_t {
+	StateNew = 0x01,
+	StateMoveDir = 0x02,
+	StateZHeight = 0x04,
+	StateAlive = 0x08,
+	StateBodyFull = 0x10,
+	StateBodyStep = 0x20,
+};
+
+SharedBytes Game::encode_state_message(uint32_t baseline_tick) const {
+	assert(!history.empty() && "call record_snapshot() before encoding state");
+	Snapshot const &now = history.back();
+	Snapshot const *base = snapshot_at(baseline_tick);
+
+	auto out = std::make_shared< std::vector< uint8_t > >();
+	std::vector< uint8_t > &bytes = *out;
+
+	auto send_raw = [&](void const *data, size_t size) {
+		bytes.insert(bytes.end(), reinterpret_cast< uint8_t const * >(data), reinterpret_cast< uint8_t const * >(data) + size);
+	};
+	auto send = [&](auto const &val) {
+		send_raw(&val, sizeof(val));
+	};
+
+	send(Message::S2C_State);
+	//will patch message size in later, for now placeholder bytes:
+	send(uint8_t(0));
+	send(uint8_t(0));
+	send(uint8_t(0));
+	size_t mark = bytes.size(); //keep track of this position in the buffer
+
+	send(now.tick);
+	send(base ? base->tick : NoTick);
+
+	//(map is sent separately, only to clients that don't have it -- see send_map_message)
+	send(map_hash);
+
+	//apples (rarely change, so either "same as baseline" or the whole list):
+	bool apples_changed = !base || base->apples.size() != now.apples.size();
+	for (size_t i = 0; !apples_changed && i < now.apples.size(); ++i) {
+		apples_changed = (now.apples[i].position != base->apples[i].position || now.apples[i].type != base->apples[i].type);
+	}
+	send(uint8_t(apples_changed ? 1 : 0));
+	if (apples_changed) {
+		send(uint32_t(now.apples.size()));
+		send_raw(now.apples.data(), now.apples.size() * sizeof(Apple));
+	}
+
+	//baseline players by handle index:
+	std::unordered_map< uint32_t, uint32_t > base_index;
+	if (base) {
+		for (uint32_t b = 0; b < base->players.size(); ++b) {
+			base_index.emplace(base->players[b].handle.index, b);
 		}
-		else if (p.controls.down.pressed && move_valid(down)) {
-			vel = glm::ivec3(0, -1, 0);
-			p.move_dir = down;
+	}
+
+	BodyCodec::write_varint(bytes, uint32_t(now.players.size())); //(rooms can hold hundreds of players)
+	for (auto const &player : now.players) {
+		Snapshot::PlayerState const *old = nullptr;
+		uint32_t old_index = 0;
+		auto f = base_index.find(player.handle.index);
+		if (f != base_index.end()) {
+			Snapshot::PlayerState const &candidate = base->players[f->second];
+			if (candidate.handle == player.handle && candidate.color == player.color && candidate.name == player.name) {
+				old = &candidate;
+				old_index = f->second;
+			}
 		}
-		else if (p.controls.up.pressed && move_valid(up)) {
-			vel = glm::ivec3(0, 1, 0);
-			p.move_dir = up;
+
+		//body: usually the old body minus a few tail blocks plus a few head blocks:
+		uint32_t dropped = 0;
+		bool body_step = false;
+		if (old) {
+			std::vector< glm::ivec3 > const &a = old->body;
+			std::vector< glm::ivec3 > const &b = player.body;
+			//(snakes move at most a few blocks per tick, so only look for small tail drops)
+			const uint32_t MaxDrop = 8;
+			for (uint32_t d = 0; d <= MaxDrop && d < a.size(); ++d) {
+				size_t kept = a.size() - d;
+				if (kept > b.size()) continue;
+				if (std::equal(a.begin() + d, a.end(), b.begin())) {
+					dropped = d;
+					body_step = true;
+					break;
+				}
+			}
 		}
 
-		if(p.controls.jump.pressed) {
-			p.jumpVelocity = 3.0f*p.velocity;
+		uint8_t flags = 0;
+		if (!old) {
+			flags = StateNew | StateMoveDir | StateZHeight | StateAlive | StateBodyFull;
 		} else {
-			static constexpr float gravity = 5.0f;
-			p.jumpVelocity -= gravity*elapsed;
+			if (player.move_dir != old->move_dir) flags |= StateMoveDir;
+			if (player.zHeight != old->zHeight) flags |= StateZHeight;
+			if (player.alive != old->alive) flags |= StateAlive;
+			if (!body_step) flags |= StateBodyFull;
+			else if (dropped != 0 || player.body.size() != old->body.size()) flags |= StateBodyStep;
 		}
 
-		p.zHeight += p.jumpVelocity*elapsed;
-		if(p.zHeight <= 0.5f) {
-			p.zHeight = 0.5f;
-			p.jumpVelocity = 0.0f;
+		send(flags);
+		if (flags & StateNew) {
+			send(player.color);
+			//NOTE: can't just 'send(name)' because player.name is not plain-old-data type.
+			//effectively: truncates player name to 255 chars
+			uint8_t name_len = uint8_t(std::min< size_t >(255, player.name.size()));
+			send(name_len);
+			send_raw(player.name.data(), name_len);
+		} else {
+			BodyCodec::write_varint(bytes, old_index);
 		}
+		if (flags & StateMoveDir) send(player.move_dir);
+		if (flags & StateZHeight) send(player.zHeight);
+		if (flags & StateAlive) send(player.alive);
+		if (flags & StateBodyFull) {
+			BodyCodec::write_varint(bytes, uint32_t(player.body.size()));
+			BodyCodec::write_steps(bytes, glm::ivec3(0), player.body.data(), player.body.size());
+		} else if (flags & StateBodyStep) {
+			uint32_t kept = uint32_t(old->body.size()) - dropped;
+			uint32_t added = uint32_t(player.body.size()) - kept;
+			BodyCodec::write_varint(bytes, dropped);
+			BodyCodec::write_varint(bytes, added);
+			glm::ivec3 from = (kept ? player.body[kept-1] : glm::ivec3(0));
+			BodyCodec::write_steps(bytes, from, player.body.data() + kept, added);
+		}
+	}
 
+	//compute the message size and patch into the message header:
+	uint32_t size = uint32_t(bytes.size() - mark);
+	bytes[mark-3] = uint8_t(size);
+	bytes[mark-2] = uint8_t(size >> 8);
+	bytes[mark-1] = uint8_t(size >> 16);
 
-		p.next_move_timer -= elapsed;
-		while(p.next_move_timer < 0) {
-			p.next_move_timer += (1.0f / p.velocity);
+	return out;
+}
 
+void Game::encode_you_message(Player::Handle connection_player, uint32_t input_seq, uint8_t *header) const {
+	assert(header);
+
+	//which player in the state is this connection's, the last of its inputs applied, and the
+	// movement state the client needs to replay later inputs on top of this state (see Game::send_input):
+	//  [S2C_You][size:3][index:4][input seq:4][jumpVelocity:4][next_move_timer:4]
+	uint32_t you = (players.valid(connection_player) ? players.slot(connection_player) : ~0u);
+	float jumpVelocity = (you != ~0u ? players.jumpVelocity[you] : 0.0f);
+	float next_move_timer = (you != ~0u ? players.next_move_timer[you] : 0.0f);
+	header[0] = uint8_t(Message::S2C_You);
+	header[1] = YouSize;
+	header[2] = 0;
+	header[3] = 0;
+	std::memcpy(header + 4, &you, 4);
+	std::memcpy(header + 8, &input_seq, 4);
+	std::memcpy(header + 12, &jumpVelocity, 4);
+	std::memcpy(header + 16, &next_move_timer, 4);
+}
 
-			glm::ivec3 new_head_pos = p.block_positions.back() + vel;
-			new_head_pos.z = (int)std::floor(p.zHeight);
+void Game::send_state_message(Connection *connection_, SharedBytes const &state, Player::Handle connection_player, uint32_t input_seq) const {
+	assert(connection_);
+	auto &connection = *connection_;
 
-			//check for collision with apples
-			bool hit_apple = false;
-			for(auto it = apples.begin(); it != apples.end(); it++) {
-				Apple apple = *it;
-				if(apple.position == new_head_pos) {
-					hit_apple = true;
-					applesToPlace++;
-					apples.erase(it);
-					break;
-				}
-			}
+	uint8_t header[4 + YouSize];
+	encode_you_message(connection_player, input_seq, header);
 
-			if(hit_apple) {
-				p.block_positions.emplace_back(new_head_pos);
-			} else {
-				//upadte block positions
-				size_t b_size = p.block_positions.size();
-				for(size_t i = 0; i < b_size-1; i++) {
-					p.block_positions[i] = p.block_positions[i+1];	
-				}
-				p.block_positions[b_size-1] = new_head_pos;
-			}
+	//the state itself is shared with every other connection:
+	// (and superseded by the next one, so over UDP it may be dropped rather than resent)
+	connection.send_droppable(header, sizeof(header), state);
+}
+
+SharedBytes Game::encode_deflated_message(DeflateStream *stream, uint8_t const *header, SharedBytes const &state) {
+	assert(stream);
+	assert(header);
+	assert(state);
+
+	//[S2C_Deflated][size:3][compressed S2C_You + S2C_State, flushed so it can be expanded on arrival]
+	auto out = std::make_shared< std::vector< uint8_t > >();
+	out->reserve(4 + state->size() / 2);
+	out->resize(4);
+	stream->compress(header, 4 + YouSize, false, out.get());
+	stream->compress(state->data(), state->size(), true, out.get());
+
+	uint32_t size = uint32_t(out->size() - 4);
+	if (size >= (1u << 24)) throw std::runtime_error("Compressed state too large for message.");
+	(*out)[0] = uint8_t(Message::S2C_Deflated);
+	(*out)[1] = uint8_t(size);
+	(*out)[2] = uint8_t(size >> 8);
+	(*out)[3] = uint8_t(size >> 16);
+	return out;
+}
+
+bool Game::recv_state_message(Connection *connection_) {
+	assert(connection_);
+	auto &connection = *connection_;
+	auto &recv_buffer = connection.recv_buffer;
+
+	//compressed messages are swapped for what they expand to:
+	if (recv_buffer.size() >= 4 && recv_buffer[0] == uint8_t(Message::S2C_Deflated)) {
+		if (!inflater) throw std::runtime_error("Compressed message, but compression wasn't asked for.");
+		uint32_t size = (uint32_t(recv_buffer[3]) << 16)
+		              | (uint32_t(recv_buffer[2]) << 8)
+		              |  uint32_t(recv_buffer[1]);
+		if (recv_buffer.size() < 4 + size) return false;
+		static thread_local std::vector< uint8_t > expanded;
+		expanded.clear();
+		inflater->decompress(recv_buffer.data() + 4, size, &expanded); //(not &recv_buffer[4]: size may be zero)
+		recv_buffer.replace_front(4 + size, expanded.data(), expanded.size());
+	}
+
+	//state messages are preceded by an S2C_You message (see send_state_message):
+	uint32_t you = ~0u;
+	uint32_t input_seq = 0;
+	float jumpVelocity = 0.0f;
+	float next_move_timer = 0.0f;
+	size_t start = 0; //where the state message starts
+	if (recv_buffer.size() < 4) return false;
+	if (recv_buffer[0] == uint8_t(Message::S2C_You)) {
+		if (recv_buffer[1] != YouSize || recv_buffer[2] != 0 || recv_buffer[3] != 0) throw std::runtime_error("You message with size != " + std::to_string(YouSize) + "!");
+		if (recv_buffer.size() < 4 + YouSize + 4) return false;
+		std::memcpy(&you, &recv_buffer[4], 4);
+		std::memcpy(&input_seq, &recv_buffer[8], 4);
+		std::memcpy(&jumpVelocity, &recv_buffer[12], 4);
+		std::memcpy(&next_move_timer, &recv_buffer[16], 4);
+		start = 4 + YouSize;
+		if (recv_buffer[start] != uint8_t(Message::S2C_State)) throw std::runtime_error("You message not followed by state message.");
+	}
+	if (recv_buffer[start] != uint8_t(Message::S2C_State)) return false;
+	uint32_t size = (uint32_t(recv_buffer[start+3]) << 16)
+	              | (uint32_t(recv_buffer[start+2]) << 8)
+	              |  uint32_t(recv_buffer[start+1]);
+	uint32_t at = 0;
+	//expecting complete message:
+	if (recv_buffer.size() < start + 4 + size) return false;
+
+	//copy bytes from buffer and advance position:
+	auto read = [&](auto *val) {
+		if (at + sizeof(*val) > size) {
+			throw std::runtime_error("Ran out of bytes reading state message.");
+		}
+		std::memcpy(val, &recv_buffer[start + 4 + at], sizeof(*val));
+		at += sizeof(*val);
+	};
+	//(these pass a pointer rather than indexing, since 'at' may already be at the end of the buffer; BodyCodec checks the size)
+	auto read_varint = [&](uint32_t *val) {
+		at += uint32_t(BodyCodec::read_varint(recv_buffer.data() + start + 4 + at, size - at, val));
+	};
+	auto read_steps = [&](glm::ivec3 from, uint32_t count, std::vector< glm::ivec3 > *blocks) {
+		at += uint32_t(BodyCodec::read_steps(recv_buffer.data() + start + 4 + at, size - at, from, count, blocks));
+	};
+
+	Snapshot next;
+	read(&next.tick);
+	uint32_t baseline_tick;
+	read(&baseline_tick);
+	Snapshot const *base = nullptr;
+	if (baseline_tick != NoTick) {
+		for (auto const &snapshot : received) {
+			if (snapshot.tick == baseline_tick) base = &snapshot;
 		}
+		if (!base) throw std::runtime_error("State message relative to unknown tick " + std::to_string(baseline_tick) + ".");
+	}
 
+	//server's map changed (or hasn't arrived yet)?
+	uint64_t state_map_hash;
+	read(&state_map_hash);
+	if (state_map_hash != map_hash && state_map_hash != map_requested) {
+		send_map_request_message(&connection, state_map_hash);
+	}
 
-		//reset 'downs' since controls have been handled:
-		p.controls.left.downs = 0;
-		p.controls.right.downs = 0;
-		p.controls.up.downs = 0;
-		p.controls.down.downs = 0;
-		p.controls.jump.downs = 0;
+	uint8_t apples_changed;
+	read(&apples_changed);
+	if (apples_changed) {
+		uint32_t applesSize;
+		read(&applesSize);
+		if (applesSize > size) throw std::runtime_error("Too many apples in state message.");
+		next.apples.reserve(applesSize);
+		for(uint32_t i = 0; i < applesSize; i++) {
+			Apple a(glm::ivec3(0, 0, 0), Normal);
+			read(&a);
+			next.apples.emplace_back(a);
+		}
+	} else {
+		if (!base) throw std::runtime_error("Whole state message without apples.");
+		next.apples = base->apples;
 	}
 
-	//collision resolution:
-	for (auto &p1 : players) {
-		glm::ivec3 head_pos = p1.block_positions.back();
-		//player/player collisions:
-		for (auto &p2 : players) {
-			//head / player collisions
-			for(auto block : p2.block_positions) {
-				if(head_pos == block) {
-					//kill p1 !
-					p1.alive = false;
-					break;
-				}
+	uint32_t player_count;
+	read_varint(&player_count);
+	if (player_count > size - at) throw std::runtime_error("Too many players in state message."); //(each takes at least a byte)
+	next.players.resize(player_count);
+	for (auto &player : next.players) {
+		uint8_t flags;
+		read(&flags);
+		if (flags & StateNew) {
+			//(clients don't know server handles; a local id, kept by later deltas, tells players apart between states)
+			player.handle.index = next_player_id++;
+			read(&player.color);
+			uint8_t name_len = 0;
+			read(&name_len);
+			//n.b. would probably be more efficient to directly copy from recv_buffer, but I think this is clearer:
+			for (uint8_t n = 0; n < name_len; ++n) {
+				char c;
+				read(&c);
+				player.name += c;
 			}
+		} else {
+			uint32_t old_index;
+			read_varint(&old_index);
+			if (!base || old_index >= base->players.size()) throw std::runtime_error("State message refers to unknown player.");
+			player = base->players[old_index];
+		}
+		if (flags & StateMoveDir) read(&player.move_dir);
+		if (flags & StateZHeight) read(&player.zHeight);
+		if (flags & StateAlive) read(&player.alive);
+		if (flags & StateBodyFull) {
+			uint32_t block_positions_len = 0;
+			read_varint(&block_positions_len);
+			player.body.clear();
+			read_steps(glm::ivec3(0), block_positions_len, &player.body);
+		} else if (flags & StateBodyStep) {
+			uint32_t dropped, added;
+			read_varint(&dropped);
+			read_varint(&added);
+			if (dropped > player.body.size()) throw std::runtime_error("Bad body step in state message.");
+			player.body.erase(player.body.begin(), player.body.begin() + dropped);
+			glm::ivec3 from = (player.body.empty() ? glm::ivec3(0) : player.body.back());
+			read_steps(from, added, &player.body);
+		} else if (flags & StateNew) {
+			throw std::runtime_error("New player without body in state message.");
+		}
+	}
+
+	if (at != size) throw std::runtime_error("Trailing data in state message.");
+
+	//delete message from buffer:
+	recv_buffer.consume(start + 4 + size);
+
+	//set game state from the snapshot:
+	tick = next.tick;
+	apples.clear();
+	apple_at.clear();
+	for (auto const &apple : next.apples) {
+		apple_at.emplace(apple.position, uint32_t(apples.size()));
+		apples.emplace_back(apple);
+	}
+
+	players.clear();
+	for (uint32_t p = 0; p < next.players.size(); ++p) {
+		players.add();
+	}
+	//this client's player (if any) goes in slot 0, others keep their order:
+	if (you >= next.players.size()) you = ~0u;
+	next.you = you;
+	for (uint32_t p = 0; p < next.players.size(); ++p) {
+		uint32_t i = (you == ~0u || p > you ? p : (p == you ? 0 : p + 1));
+		Snapshot::PlayerState const &player = next.players[p];
+		players.color[i] = player.color;
+		players.move_dir[i] = player.move_dir;
+		players.zHeight[i] = player.zHeight;
+		players.alive[i] = player.alive;
+		SnakeBody &body = players.body[i];
+		for (auto const &pos : player.body) {
+			body.push_head(pos);
 		}
+		if (!body.empty()) players.head[i] = body.back();
+		players.name[i] = player.name;
+	}
 
-		//player grid collisions
-		if(map.grid_idx(head_pos.x, head_pos.y) == B) {
-			p1.alive = false;
+	//this client's player is as of the last input the server applied; inputs sent since then are replayed on top:
+	have_own_player = (you != ~0u);
+	if (have_own_player) {
+		players.jumpVelocity[0] = jumpVelocity;
+		players.next_move_timer[0] = next_move_timer;
+		while (!pending_inputs.empty() && int32_t(pending_inputs.front().seq - input_seq) <= 0) {
+			pending_inputs.pop_front();
+		}
+		for (auto const &input : pending_inputs) {
+			players.controls[0] = input.controls;
+			predict_player(0, Tick);
 		}
-		
 	}
 
-	bool gamePlaying = spawnApples(applesToPlace);
-	if(gamePlaying) return;
+	//the server bases states on the newest tick it has heard about, so ticks before this baseline can go:
+	// (a whole state doesn't say anything about which acks the server has seen, so it keeps everything)
+	while (!received.empty() && ((baseline_tick != NoTick && received.front().tick < baseline_tick) || received.size() >= 2 * HistoryTicks)) {
+		received.pop_front();
+	}
+	received.emplace_back(std::move(next));
+
+	//let the server know this tick can be used as a baseline:
+	connection.send(Message::C2S_Ack);
+	connection.send(uint8_t(4));
+	connection.send(uint8_t(0));
+	connection.send(uint8_t(0));
+	connection.send(tick);
+
+	return true;
+}
+
+void Game::send_input(Connection *connection, Player::Controls const &controls) {
+	Player::Input input;
+	input.seq = next_input_seq++;
+	input.controls = controls;
+
+	//(a server that never answers shouldn't make this grow forever)
+	if (pending_inputs.size() >= MaxPendingInputs) pending_inputs.pop_front();
+	pending_inputs.emplace_back(input);
+
+	if (have_own_player && players.size() > 0) {
+		players.controls[0] = controls;
+		predict_player(0, Tick);
+	}
 
+	//inputs hold until the next one is sent, so only presses and changes in what is held need to go out:
+	Player::Controls held; //(the server starts out with nothing pressed)
+	if (!sent_inputs.empty()) held = sent_inputs.back().controls;
+	auto changed = [](Button const &b, Button const &was) {
+		return b.downs != 0 || b.pressed != was.pressed;
+	};
+	bool change = changed(controls.left, held.left) || changed(controls.right, held.right)
+	           || changed(controls.up, held.up) || changed(controls.down, held.down)
+	           || changed(controls.jump, held.jump);
+	if (change) {
+		if (sent_inputs.size() >= InputRedundancy) sent_inputs.pop_front();
+		sent_inputs.emplace_back(input);
+	}
+	//messages keep going out for a few ticks after a change, so losing one only delays the change by a tick:
+	bool recent_change = (!sent_inputs.empty() && input.seq - sent_inputs.back().seq < InputRepeatTicks);
+	if (!recent_change && last_controls_message_seq != 0 && input.seq - last_controls_message_seq < InputKeepaliveTicks) {
+		return;
+	}
+
+	//[client tick u32][count u8] + count * [ticks before client tick u8][5 buttons], oldest first:
+	// (changes older than 255 ticks have long since been applied, so they're left out)
+	while (!sent_inputs.empty() && input.seq - sent_inputs.front().seq > 255) sent_inputs.pop_front();
+	auto out = std::make_shared< std::vector< uint8_t > >();
+	out->reserve(5 + 6 * sent_inputs.size());
+	out->resize(5);
+	std::memcpy(out->data(), &input.seq, 4);
+	(*out)[4] = uint8_t(sent_inputs.size());
+	auto send_button = [&](Button const &b) {
+		if (b.downs & 0x80) {
+			std::cerr << "Wow, you are really good at pressing buttons!" << std::endl;
+		}
+		out->emplace_back(uint8_t( (b.pressed ? 0x80 : 0x00) | (b.downs & 0x7f) ) );
+	};
+	for (auto const &sent : sent_inputs) {
+		out->emplace_back(uint8_t(input.seq - sent.seq));
+		send_button(sent.controls.left);
+		send_button(sent.controls.right);
+		send_button(sent.controls.up);
+		send_button(sent.controls.down);
+		send_button(sent.controls.jump);
+	}
+
+	uint32_t size = uint32_t(out->size());
+	uint8_t header[4] = { uint8_t(Message::C2S_Controls), uint8_t(size), uint8_t(size >> 8), uint8_t(size >> 16) };
+	//(each message repeats the inputs before it, so over UDP a lost one is simply superseded by the next)
+	connection->send_droppable(header, sizeof(header), out);
+	last_controls_message_seq = input.seq;
+	controls_messages_sent += 1;
 }
 
+bool Game::recv_ack_message(Connection *connection_, uint32_t *tick_) {
+	assert(connection_);
+	assert(tick_);
+	auto &recv_buffer = connection_->recv_buffer;
 
-void Game::send_state_message(Connection *connection_, Player *connection_player) const {
+	//expecting [type, size_low0, size_mid8, size_high8] + 4 byte tick:
+	if (recv_buffer.size() < 4) return false;
+	if (recv_buffer[0] != uint8_t(Message::C2S_Ack)) return false;
+	uint32_t size = (uint32_t(recv_buffer[3]) << 16)
+	              | (uint32_t(recv_buffer[2]) << 8)
+	              |  uint32_t(recv_buffer[1]);
+	if (size != 4) throw std::runtime_error("Ack message with size " + std::to_string(size) + " != 4!");
+	if (recv_buffer.size() < 4 + size) return false;
+
+	std::memcpy(tick_, &recv_buffer[4], sizeof(*tick_));
+
+	recv_buffer.consume(4 + size);
+	return true;
+}
+
+void Game::send_map_info_message(Connection *connection_) const {
 	assert(connection_);
 	auto &connection = *connection_;
 
-	connection.send(Message::S2C_State);
-	//will patch message size in later, for now placeholder bytes:
-	connection.send(uint8_t(0));
+	connection.send(Message::S2C_MapInfo);
+	connection.send(uint8_t(16));
 	connection.send(uint8_t(0));
 	connection.send(uint8_t(0));
-	size_t mark = connection.send_buffer.size(); //keep track of this position in the buffer
-
-
-	//send player info helper:
-	auto send_player = [&](Player const &player) {
-		connection.send(player.color);
-		connection.send(player.move_dir);
-		connection.send(player.zHeight);
-		connection.send(player.alive);
-	
-		uint32_t len = uint32_t(player.block_positions.size());
-		connection.send(len);
-		for(uint32_t i = 0; i < player.block_positions.size(); i++) {
-			connection.send(player.block_positions[i]);
-		}
-
-		//NOTE: can't just 'send(name)' because player.name is not plain-old-data type.
-		//effectively: truncates player name to 255 chars
-		uint8_t name_len = uint8_t(std::min< size_t >(255, player.name.size()));
-		connection.send(name_len);
-		connection.send_buffer.insert(connection.send_buffer.end(), player.name.begin(), player.name.begin() + name_len);
+	connection.send(map_hash);
+	connection.send(uint32_t(map.width));
+	connection.send(uint32_t(map.height));
+}
+
+void Game::send_map_message(Connection *connection_) const {
+	assert(connection_);
+	auto &connection = *connection_;
+
+	//size header helper (as in send_state_message):
+	auto begin_message = [&](Message type) {
+		connection.send(type);
+		connection.send(uint8_t(0));
+		connection.send(uint8_t(0));
+		connection.send(uint8_t(0));
+		return connection.send_buffer.size();
+	};
+	auto end_message = [&](size_t mark) {
+		uint32_t size = uint32_t(connection.send_buffer.size() - mark);
+		connection.send_buffer[mark-3] = uint8_t(size);
+		connection.send_buffer[mark-2] = uint8_t(size >> 8);
+		connection.send_buffer[mark-1] = uint8_t(size >> 16);
 	};
 
-	//TODO change to only send when player joins?
-	//map count
+	size_t mark = begin_message(Message::S2C_Map);
+	connection.send(map_hash);
 	connection.send(uint32_t(map.width));
 	connection.send(uint32_t(map.height));
-	connection.send_buffer.insert(connection.send_buffer.end(), map.blocks.begin(), map.blocks.begin() + map.width*map.height);
-
-	//apple count
-	connection.send(uint32_t(apples.size()));
-	for(auto it = apples.begin(); it != apples.end(); it++) {
-		connection.send(*it);
+	end_message(mark);
+
+	for (uint32_t cy = 0; cy < map.chunks_y; ++cy) {
+		for (uint32_t cx = 0; cx < map.chunks_x; ++cx) {
+			Map::Chunk const *chunk = map.chunks[cy * map.chunks_x + cx].get();
+			if (!chunk) continue; //client's map starts out as all ground
+			mark = begin_message(Message::S2C_MapChunk);
+			connection.send(uint32_t(cx));
+			connection.send(uint32_t(cy));
+			connection.send_raw(chunk->blocks, sizeof(chunk->blocks));
+			end_message(mark);
+		}
 	}
 
-	//player count:
-	connection.send(uint8_t(players.size()));
-	if (connection_player) send_player(*connection_player);
-	for (auto const &player : players) {
-		if (&player == connection_player) continue;
-		send_player(player);
-	}
+	mark = begin_message(Message::S2C_MapDone);
+	connection.send(map_hash);
+	end_message(mark);
+}
 
-	//compute the message size and patch into the message header:
-	uint32_t size = uint32_t(connection.send_buffer.size() - mark);
-	connection.send_buffer[mark-3] = uint8_t(size);
-	connection.send_buffer[mark-2] = uint8_t(size >> 8);
-	connection.send_buffer[mark-1] = uint8_t(size >> 16);
+bool Game::recv_map_request_message(Connection *connection_, uint64_t *hash) {
+	assert(connection_);
+	assert(hash);
+	auto &recv_buffer = connection_->recv_buffer;
+
+	//expecting [type, size_low0, size_mid8, size_high8] + 8 byte hash:
+	if (recv_buffer.size() < 4) return false;
+	if (recv_buffer[0] != uint8_t(Message::C2S_MapRequest)) return false;
+	uint32_t size = (uint32_t(recv_buffer[3]) << 16)
+	              | (uint32_t(recv_buffer[2]) << 8)
+	              |  uint32_t(recv_buffer[1]);
+	if (size != 8) throw std::runtime_error("Map request message with size " + std::to_string(size) + " != 8!");
+	if (recv_buffer.size() < 4 + size) return false;
+
+	std::memcpy(hash, &recv_buffer[4], sizeof(*hash));
+
+	recv_buffer.consume(4 + size);
+	return true;
 }
 
-bool Game::recv_state_message(Connection *connection_) {
+void Game::send_map_request_message(Connection *connection_, uint64_t hash) {
+	assert(connection_);
+	auto &connection = *connection_;
+
+	connection.send(Message::C2S_MapRequest);
+	connection.send(uint8_t(8));
+	connection.send(uint8_t(0));
+	connection.send(uint8_t(0));
+	connection.send(hash);
+
+	map_requested = hash;
+}
+
+bool Game::recv_deflate_request_message(Connection *connection_) {
+	assert(connection_);
+	auto &recv_buffer = connection_->recv_buffer;
+
+	//expecting [type, size_low0, size_mid8, size_high8] with no payload:
+	if (recv_buffer.size() < 4) return false;
+	if (recv_buffer[0] != uint8_t(Message::C2S_Deflate)) return false;
+	uint32_t size = (uint32_t(recv_buffer[3]) << 16)
+	              | (uint32_t(recv_buffer[2]) << 8)
+	              |  uint32_t(recv_buffer[1]);
+	if (size != 0) throw std::runtime_error("Deflate request message with size " + std::to_string(size) + " != 0!");
+
+	recv_buffer.consume(4);
+	return true;
+}
+
+void Game::send_deflate_request_message(Connection *connection_) {
+	assert(connection_);
+	auto &connection = *connection_;
+
+	connection.send(Message::C2S_Deflate);
+	connection.send(uint8_t(0));
+	connection.send(uint8_t(0));
+	connection.send(uint8_t(0));
+
+	//(states may still arrive uncompressed until the server sees this)
+	if (!inflater) inflater = std::make_unique< InflateStream >();
+}
+
+//where a map with a given hash is cached:
+static std::string map_cache_path(std::string const &dir, uint64_t hash) {
+	char name[32];
+	std::snprintf(name, sizeof(name), "%016llx.map", (unsigned long long)hash);
+	return dir + "/" + name;
+}
+
+bool Game::recv_map_message(Connection *connection_) {
 	assert(connection_);
 	auto &connection = *connection_;
 	auto &recv_buffer = connection.recv_buffer;
 
 	if (recv_buffer.size() < 4) return false;
-	if (recv_buffer[0] != uint8_t(Message::S2C_State)) return false;
+	if (recv_buffer[0] != uint8_t(Message::S2C_MapInfo)
+	 && recv_buffer[0] != uint8_t(Message::S2C_Map)
+	 && recv_buffer[0] != uint8_t(Message::S2C_MapChunk)
+	 && recv_buffer[0] != uint8_t(Message::S2C_MapDone)) return false;
 	uint32_t size = (uint32_t(recv_buffer[3]) << 16)
 	              | (uint32_t(recv_buffer[2]) << 8)
 	              |  uint32_t(recv_buffer[1]);
@@ -367,70 +1467,83 @@ bool Game::recv_state_message(Connection *connection_) {
 	//copy bytes from buffer and advance position:
 	auto read = [&](auto *val) {
 		if (at + sizeof(*val) > size) {
-			throw std::runtime_error("Ran out of bytes reading state message.");
+			throw std::runtime_error("Ran out of bytes reading map message.");
 		}
 		std::memcpy(val, &recv_buffer[4 + at], sizeof(*val));
 		at += sizeof(*val);
 	};
 
-	read(&map.width);
-	read(&map.height);
-	if(map.blocks.size() <= 0) map.blocks.reserve(map.width*map.height);
-	for(uint32_t i = 0; i < map.width*map.height; i++) {
-		MapBlock m;
-		read(&m);
-		map.blocks[i] = m;
-	}
-
-	uint32_t applesSize;
-	read(&applesSize);
-	apples.clear();
-	for(uint32_t i = 0; i < applesSize; i++) {
-		Apple a(glm::ivec3(0, 0, 0), Normal);
-		read(&a);
-		apples.emplace_back(a);
-	}
-
-	players.clear();
-	uint8_t player_count;
-	read(&player_count);
-	for (uint8_t i = 0; i < player_count; ++i) {
-		players.emplace_back();
-		Player &player = players.back();
-		read(&player.color);
-		read(&player.move_dir);
-		read(&player.zHeight);
-		read(&player.alive);
-	
-
-
-		uint8_t block_positions_len = 0;
-		read(&block_positions_len);
-		player.block_positions = std::vector<glm::ivec3>();
-		player.block_positions.reserve(block_positions_len);
-		for (uint32_t b = 0; b < block_positions_len; ++b) {
-			glm::ivec3 p;
-			read(&p);
-			player.block_positions.emplace_back(p);
+	if (recv_buffer[0] == uint8_t(Message::S2C_MapInfo)) {
+		uint64_t hash;
+		uint32_t width, height;
+		read(&hash);
+		read(&width);
+		read(&height);
+		if (hash != map_hash) {
+			//already downloaded this arena some other time?
+			bool cached = false;
+			if (map_cache_dir != "") {
+				std::string path = map_cache_path(map_cache_dir, hash);
+				try {
+					Map loaded;
+					loaded.load(path);
+					if (loaded.hash() == hash) {
+						map = loaded;
+						map_hash = hash;
+						cached = true;
+					} else {
+						std::cerr << "Ignoring cached map '" << path << "' (contents don't match hash)." << std::endl;
+					}
+				} catch (std::exception &) {
+					//(not cached, or unreadable)
+				}
+			}
+			if (!cached) send_map_request_message(&connection, hash);
 		}
-
-
-		uint8_t name_len = 0;
-		read(&name_len);
-		//n.b. would probably be more efficient to directly copy from recv_buffer, but I think this is clearer:
-		player.name = "";
-		for (uint8_t n = 0; n < name_len; ++n) {
-			char c;
-			read(&c);
-			player.name += c;
+	} else if (recv_buffer[0] == uint8_t(Message::S2C_Map)) {
+		uint64_t hash;
+		uint32_t width, height;
+		read(&hash);
+		read(&width);
+		read(&height);
+		if (width == 0 || height == 0 || width > Map::MaxSize || height > Map::MaxSize) {
+			throw std::runtime_error("Map message with bad size " + std::to_string(width) + "x" + std::to_string(height) + ".");
+		}
+		map.resize(width, height);
+		map_hash = 0; //(not complete yet)
+	} else if (recv_buffer[0] == uint8_t(Message::S2C_MapChunk)) {
+		uint32_t cx, cy;
+		read(&cx);
+		read(&cy);
+		if (cx >= map.chunks_x || cy >= map.chunks_y) {
+			throw std::runtime_error("Map chunk " + std::to_string(cx) + "," + std::to_string(cy) + " is outside the map.");
+		}
+		Map::Chunk &chunk = map.edit_chunk(cx, cy);
+		read(&chunk.blocks);
+		for (MapBlock b : chunk.blocks) {
+			if (b > DR) throw std::runtime_error("Map chunk has unknown block " + std::to_string(int(b)) + ".");
+		}
+		map.count_ground(cx, cy);
+	} else { assert(recv_buffer[0] == uint8_t(Message::S2C_MapDone));
+		uint64_t hash;
+		read(&hash);
+		if (map.hash() != hash) throw std::runtime_error("Downloaded map doesn't match its hash.");
+		map_hash = hash;
+		if (map_requested == hash) map_requested = 0;
+		if (map_cache_dir != "") {
+			try {
+				std::filesystem::create_directories(map_cache_dir);
+				map.save(map_cache_path(map_cache_dir, hash));
+			} catch (std::exception &e) {
+				std::cerr << "Failed to cache map: " << e.what() << std::endl;
+			}
 		}
-
 	}
 
-	if (at != size) throw std::runtime_error("Trailing data in state message.");
+	if (at != size) throw std::runtime_error("Trailing data in map message.");
 
 	//delete message from buffer:
-	recv_buffer.erase(recv_buffer.begin(), recv_buffer.begin() + 4 + size);
+	recv_buffer.consume(4 + size);
 
 	return true;
 }
@@ -6,13 +6,19 @@
 #include "LitColorTextureProgram.hpp"
 #include "gl_errors.hpp"
 #include "data_path.hpp"
+#include "WorkerPool.hpp"
+#include "Connection.hpp"
+#include "StateDeflate.hpp"
 
 #include <string>
 #include <list>
 #include <random>
 #include <vector>
-
-struct Connection;
+#include <unordered_map>
+#include <memory>
+#include <deque>
+#include <cassert>
+#include <algorithm>
 
 //Game state, separate from rendering.
 
@@ -20,7 +26,16 @@ struct Connection;
 
 enum class Message : uint8_t {
 	C2S_Controls = 1, //Greg!
+	C2S_Ack = 'a', //tick of the last state message the client has received
+	C2S_MapRequest = 'r', //client doesn't have the map with this hash; please send it
+	C2S_Deflate = 'z', //client can read S2C_Deflated; please compress its states (TCP only)
 	S2C_State = 's',
+	S2C_You = 'y', //index of the receiving client's own player in the next state message (+ its prediction state)
+	S2C_MapInfo = 'h', //hash (and size) of the map in use; sent on join
+	S2C_Map = 'm', //start of a map download: hash and size (client resets its map)
+	S2C_MapChunk = 'c', //contents of one map chunk
+	S2C_MapDone = 'd', //end of a map download
+	S2C_Deflated = 'Z', //an S2C_You + S2C_State pair, compressed with the connection's DeflateStream
 	//...
 };
 
@@ -41,27 +56,118 @@ enum MapBlock : uint8_t {
 	DR = 7 //barrier up right corner
 };
 
+//the arena; stored as ChunkSize x ChunkSize chunks so that big maps are handled (stored, queried, sent) a chunk at a time:
 struct Map {
-	std::vector<MapBlock> blocks = {
-		G, G, G, G, G, G, G, G, G, G,
-		G, G, G, G, G, G, G, G, G, G,
-		G, G, G, G, G, G, G, G, G, G,
-		G, G, G, G, G, G, G, G, G, G,
-		G, G, G, G, G, G, G, G, G, G,
-		G, G, G, G, G, G, G, G, G, G,
-		G, G, G, G, G, G, G, G, G, G,
-		G, G, G, G, G, G, G, G, G, G,
-		G, G, G, G, G, G, G, G, G, G,
-		G, G, G, G, G, G, G, G, G, G
+	inline static constexpr uint32_t ChunkSize = 32;
+	inline static constexpr uint32_t MaxSize = 4096; //largest width/height accepted from a map file or message
+
+	struct Chunk {
+		MapBlock blocks[ChunkSize * ChunkSize];
+		uint32_t ground = 0; //ground blocks that are on the map (edge chunks hang over it); see count_ground
 	};
+	//chunks in row-major order; nullptr means "all ground" (so open areas take no memory):
+	// (chunks are shared between copies of a map, so copying one -- e.g., into each match -- copies no blocks)
+	std::vector< std::shared_ptr< Chunk > > chunks;
+
+	uint32_t width = 0;
+	uint32_t height = 0;
+	uint32_t chunks_x = 0; //== ceil(width / ChunkSize)
+	uint32_t chunks_y = 0;
 
-	uint32_t width = 10;
-	uint32_t height = 10;
+	Map(); //default 10x10 open arena
 
-	MapBlock grid_idx(int x, int y) {
-		return blocks[y*width + x];
+	void resize(uint32_t width, uint32_t height); //(resets every block to ground)
+
+	MapBlock grid_idx(int x, int y) const {
+		assert(x >= 0 && uint32_t(x) < width && y >= 0 && uint32_t(y) < height);
+		Chunk const *chunk = chunks[(uint32_t(y) / ChunkSize) * chunks_x + (uint32_t(x) / ChunkSize)].get();
+		if (!chunk) return G;
+		return chunk->blocks[(uint32_t(y) % ChunkSize) * ChunkSize + (uint32_t(x) % ChunkSize)];
+	}
+	void set(int x, int y, MapBlock block);
+	//a chunk that can be changed (allocating an all-ground chunk, or copying one shared with another map):
+	// (call count_ground after changing its blocks)
+	Chunk &edit_chunk(uint32_t cx, uint32_t cy);
+	void count_ground(uint32_t cx, uint32_t cy);
+	//blocks of a chunk that are on the map (ChunkSize * ChunkSize, but less along the far edges):
+	glm::uvec2 chunk_extent(uint32_t cx, uint32_t cy) const {
+		return glm::uvec2(std::min(ChunkSize, width - cx * ChunkSize), std::min(ChunkSize, height - cy * ChunkSize));
 	}
 
+	//read a map from a text file, one character per block, first line is the top (highest y) row:
+	//  '.' or '0' ground, '#' or '1' barrier, '2'-'7' other barrier kinds (see MapBlock)
+	//throws on error
+	void load(std::string const &filename);
+	//write a map in the format read by load (throws on error):
+	void save(std::string const &filename) const;
+
+	//hash of size and contents (identifies a map between server and clients):
+	uint64_t hash() const;
+};
+
+//hash for using grid cells as keys in unordered containers:
+struct IVec3Hash {
+	size_t operator()(glm::ivec3 const &v) const {
+		//(large-prime mix; cells are small integers so this spreads them well enough)
+		return size_t(uint32_t(v.x) * 73856093u ^ uint32_t(v.y) * 19349663u ^ uint32_t(v.z) * 83492791u);
+	}
+};
+
+//per-tick count of snake blocks in each (x, y, z) cell, used to make collision checks O(1):
+// counts over the map (in the lowest 'Layers' z layers) are kept per map chunk, allocated the first time
+// a snake enters that chunk; anything else (snakes can wander off the map edge or jump high) goes in a sparse table.
+struct Occupancy {
+	inline static constexpr int32_t Layers = 4;
+	struct Chunk {
+		uint32_t counts[Layers * Map::ChunkSize * Map::ChunkSize] = {};
+	};
+	std::vector< std::unique_ptr< Chunk > > chunks; //indexed like Map::chunks
+	std::unordered_map< glm::ivec3, uint32_t, IVec3Hash > overflow;
+	//counters touched since the last clear (so clearing doesn't need to walk every chunk):
+	std::vector< uint32_t * > touched;
+
+	int32_t width = 0;
+	int32_t height = 0;
+	uint32_t chunks_x = 0;
+
+	void resize(Map const &map);
+	void clear();
+	void add(glm::ivec3 const &cell);
+	uint32_t count(glm::ivec3 const &cell) const;
+};
+
+//map cells something can spawn on (ground, no snake block at ground level, no apple):
+// kept up to date incrementally, per map chunk: a chunk with nothing blocking it needs no storage (its free cells
+// are just its ground blocks); the first block in a chunk gives it a dense list + per-cell slot index, so removal
+// is a swap-remove. Free counts per chunk are kept in a Fenwick tree, so finding the i'th free cell is O(log chunks).
+struct FreeCells {
+	inline static constexpr uint16_t NotFree = 0xffff;
+	static_assert(Map::ChunkSize * Map::ChunkSize < NotFree, "cell within a chunk fits in a uint16_t");
+	struct Chunk {
+		std::vector< uint16_t > cells; //free cells ((y % ChunkSize) * ChunkSize + (x % ChunkSize)), in no particular order
+		uint16_t slot[Map::ChunkSize * Map::ChunkSize]; //position of each cell in 'cells', or NotFree
+		uint16_t blockers[Map::ChunkSize * Map::ChunkSize]; //number of snake blocks / apples on each cell
+	};
+	//indexed like Map::chunks; nullptr => nothing blocked in the chunk yet
+	// (a chunk is kept once listed, so blocking and unblocking never allocate after a chunk's first use)
+	std::vector< std::unique_ptr< Chunk > > chunks;
+	std::vector< uint32_t > tree; //Fenwick tree of free cells per chunk (1-based)
+	uint32_t total = 0; //free cells in all chunks
+	Map const *map = nullptr; //(to tell ground from barrier)
+
+	int32_t width = 0;
+	int32_t height = 0;
+
+	void reset(Map const &map); //all ground cells free
+	void block(glm::ivec3 const &cell); //(cells off the map are ignored)
+	void unblock(glm::ivec3 const &cell);
+
+	size_t size() const { return total; }
+	glm::ivec2 operator[](size_t i) const;
+
+	//internals:
+	void add_count(uint32_t chunk, int32_t delta);
+	Chunk &list_chunk(uint32_t chunk); //(lists a chunk's free cells, if not already listed)
 };
 
 enum Direction : uint8_t {
@@ -71,34 +177,139 @@ enum Direction : uint8_t {
 	down
 };
 
-//state of one player in the game:
+//snake body blocks, ordered tail-to-head, stored in a power-of-two ring buffer:
+// (moving overwrites the tail slot with the new head, so a step is O(1) regardless of length)
+struct SnakeBody {
+	std::vector< glm::ivec3 > ring;
+	uint32_t tail = 0; //index of the tail block in ring
+	uint32_t count = 0; //number of blocks in use
+
+	size_t size() const { return count; }
+	bool empty() const { return count == 0; }
+	void clear() { tail = 0; count = 0; }
+
+	//i-th block counting from the tail (so [size()-1] is the head):
+	glm::ivec3 const &operator[](size_t i) const { return ring[(tail + i) & (ring.size() - 1)]; }
+	glm::ivec3 const &front() const { return (*this)[0]; }
+	glm::ivec3 const &back() const { return (*this)[count - 1]; }
+
+	//add a new head without dropping the tail (amortized O(1)):
+	void push_head(glm::ivec3 const &head);
+	//add a new head and drop the tail; returns the dropped tail block:
+	glm::ivec3 advance(glm::ivec3 const &head);
+
+	//ordered (tail-to-head) view as at most two contiguous runs of the ring:
+	struct Span {
+		glm::ivec3 const *data = nullptr;
+		size_t size = 0;
+	};
+	Span first_span() const;
+	Span second_span() const;
+
+	struct const_iterator {
+		SnakeBody const *body;
+		size_t i;
+		glm::ivec3 const &operator*() const { return (*body)[i]; }
+		const_iterator &operator++() { ++i; return *this; }
+		bool operator!=(const_iterator const &o) const { return i != o.i; }
+	};
+	const_iterator begin() const { return const_iterator{this, 0}; }
+	const_iterator end() const { return const_iterator{this, count}; }
+};
+
+//per-player types and defaults (the per-player state itself lives in 'Players', below):
 struct Player {
 	//player inputs (sent from client):
 	struct Controls {
 		Button left, right, up, down, jump;
+	};
 
-		void send_controls_message(Connection *connection) const;
-
-		//returns 'false' if no message or not a controls message,
-		//returns 'true' if read a controls message,
-		//throws on malformed controls message
-		bool recv_controls_message(Connection *connection);
-	} controls;
-
-	//player state (sent from server):
-	glm::vec3 color = glm::vec3(1.0f, 1.0f, 1.0f);
-	Direction move_dir = right;
+	//controls as of one client tick ('seq' counts client ticks, so the server can apply them on the matching tick):
+	struct Input {
+		uint32_t seq = 0;
+		Controls controls;
+	};
 
-	float velocity = 1.0f;
-	float jumpVelocity = 2.0f;
-	float zHeight = 0.5f;
-	float next_move_timer = 1.0f / velocity;
-	bool alive = true;
+	//stable reference to a player (stays valid while other players come and go):
+	struct Handle {
+		uint32_t index = ~0u;
+		uint32_t generation = 0;
+		bool operator==(Handle const &o) const { return index == o.index && generation == o.generation; }
+		bool operator!=(Handle const &o) const { return !(*this == o); }
+	};
 
+	//initial player state:
+	inline static constexpr float DefaultVelocity = 1.0f;
+	inline static constexpr float DefaultJumpVelocity = 2.0f;
+	inline static constexpr float DefaultZHeight = 0.5f;
+};
 
-	std::vector<glm::ivec3> block_positions; //position of first block is effectively the player's head
+//state of all players in the game, stored as parallel arrays (one slot per live player):
+// the per-tick simulation walks the hot arrays front-to-back; removing a player moves
+// the last player into its slot, so slots change but Player::Handles don't.
+struct Players {
+	//--- hot (touched every tick) ---
+	std::vector< glm::ivec3 > head; //== body[i].back()
+	std::vector< float > zHeight;
+	std::vector< float > jumpVelocity;
+	std::vector< float > next_move_timer;
+	std::vector< float > velocity;
+	std::vector< Direction > move_dir;
+	std::vector< uint8_t > alive;
+	std::vector< Player::Controls > controls;
+
+	//--- cold ---
+	std::vector< SnakeBody > body; //tail-to-head; last block is effectively the player's head
+	std::vector< glm::vec3 > color;
+	std::vector< std::string > name;
+	std::vector< Player::Handle > handle; //handle of the player in each slot
+
+	size_t size() const { return head.size(); }
+
+	Player::Handle add(); //append a player with default state; returns its handle
+	void remove(Player::Handle handle);
+	void clear();
+
+	bool valid(Player::Handle handle) const;
+	uint32_t slot(Player::Handle handle) const; //current slot of a (valid) handle
+
+	//handle bookkeeping:
+	std::vector< uint32_t > slot_of; //indexed by Handle::index
+	std::vector< uint32_t > generation_of; //indexed by Handle::index
+	std::vector< uint32_t > free_indices;
+};
 
-	std::string name = "";
+//server-side timeline of one client's inputs:
+// clients send controls only when they change (see Game::send_input), so an input holds until the next one;
+// the server steps through the client's ticks one per update, applying each input on its own tick.
+struct InputTimeline {
+	//contents of a controls message (C2S_Controls):
+	struct ControlsMessage {
+		uint32_t tick = 0; //client tick it was sent on
+		uint32_t count = 0;
+		Player::Input inputs[4]; //latest changes, oldest first
+	};
+	//read a controls message without queueing it (e.g., on a network thread; see NetThread):
+	//returns 'false' if no message or not a controls message,
+	//returns 'true' if read a controls message,
+	//throws on malformed controls message
+	static bool recv_controls_message(Connection *connection, ControlsMessage *message);
+	//queue the inputs in a message that haven't been seen before:
+	void receive(ControlsMessage const &message);
+	//read a controls message and queue its new inputs (same returns/throws as above):
+	bool recv_controls_message(Connection *connection);
+	//move on to the client's next tick, folding the inputs due by then into 'controls':
+	void advance(Player::Controls *controls);
+
+	uint32_t applied = 0; //client tick reached by the last advance() (echoed in states; 0 => none yet)
+	uint32_t newest = 0; //newest input seq received (repeated copies of older inputs are skipped)
+	bool synced = false; //has 'applied' been lined up with the client's tick yet?
+	std::deque< Player::Input > queued; //received but not yet applied (oldest first)
+	uint64_t late = 0; //inputs that arrived after their tick had been applied (applied on the next tick instead)
+
+	//how far ahead of 'applied' a client's tick may run before the timeline jumps forward to it:
+	// (arrivals more than a tick behind make it jump back, so it settles at about one tick of slack)
+	inline static constexpr int32_t MaxLead = 4;
 };
 
 enum AppleType : uint8_t {
@@ -112,18 +323,51 @@ struct Apple {
 	Apple(glm::ivec3 _p, AppleType _t) : position(_p), type(_t) {};
 };
 
+//the part of the game state that is sent to clients, as of one tick
+// (the server keeps a few recent ticks, so it can send each client just the differences from a tick that client has):
+struct Snapshot {
+	uint32_t tick = 0;
+	std::vector< Apple > apples;
+	struct PlayerState {
+		//used to match players between ticks:
+		// (server: the player's handle; client: a local id that stays the same as long as the player does)
+		Player::Handle handle;
+		glm::vec3 color = glm::vec3(1.0f);
+		Direction move_dir = right;
+		float zHeight = 0.0f;
+		uint8_t alive = 1;
+		std::vector< glm::ivec3 > body; //tail-to-head
+		std::string name;
+	};
+	std::vector< PlayerState > players; //in slot order
+	uint32_t you = ~0u; //(client only) index of the receiving client's own player in 'players'
+};
+
 struct Game {
-	std::list< Player > players; //(using list so they can have stable addresses)
-	Player *spawn_player(); //add player the end of the players list (may also, e.g., play some spawn anim)
-	void remove_player(Player *); //remove player from game (may also, e.g., play some despawn anim)
+	Players players;
+	Player::Handle spawn_player(); //add player the end of the players list (may also, e.g., play some spawn anim)
+	void remove_player(Player::Handle); //remove player from game (may also, e.g., play some despawn anim)
 	bool gamePlaying = false;
 
-	std::list<Apple> apples;
+	std::vector< Apple > apples; //(contiguous, so it can be sent as one block)
+	std::unordered_map< glm::ivec3, uint32_t, IVec3Hash > apple_at; //cell -> index in apples
+	void add_apple(Apple const &apple);
+	void remove_apple(uint32_t index); //swap-removes, so the last apple's index changes
 	bool spawnApples(uint32_t applesToPlace);
-	std::list<glm::ivec2> valid_spawn_positions();
 
+	FreeCells free_cells; //where players & apples may spawn
+	//snake blocks only block spawning at ground level:
+	void block_snake_cell(glm::ivec3 const &block) { if (block.z <= 0) free_cells.block(block); }
+	void unblock_snake_cell(glm::ivec3 const &block) { if (block.z <= 0) free_cells.unblock(block); }
+
+
+	Map map;
+	uint64_t map_hash = 0; //== map.hash()
+	//replace the map (e.g., one read with Map::load); only valid before any players have joined:
+	// (takes the map's hash, so a map shared by many matches is only hashed once)
+	void set_map(Map const &map, uint64_t map_hash);
 
-	Map map{};
+	Occupancy occupancy; //rebuilt each update() for collision resolution
 
 	std::mt19937 mt; //used for spawning players & apples
 	uint32_t next_player_number = 1; //used for naming players
@@ -133,6 +377,29 @@ struct Game {
 	//state update function:
 	void update(float elapsed);
 
+	//ticks (calls to update) so far; on clients, tick of the last state received:
+	uint32_t tick = 0;
+	inline static constexpr uint32_t NoTick = ~0u;
+
+	//(optional) threads to split per-player update work across; results are identical with or without:
+	WorkerPool *workers = nullptr;
+
+	//per-player movement planned during update(), before it is applied:
+	struct Move {
+		glm::ivec3 vel = glm::ivec3(0);
+		int32_t z = 0;
+		uint32_t steps = 0;
+		//each step moves the head by 'vel' and puts it in layer 'z':
+		glm::ivec3 next_head(glm::ivec3 head) const { head += vel; head.z = z; return head; }
+	};
+	std::vector< Move > moves;
+
+	//movement rules for one player (shared by update() and client-side prediction):
+	// reads slot i's controls, updates its direction / jump / move timer, and returns how its head moves:
+	Move plan_move(uint32_t i, float elapsed);
+	//run the movement rules for one player alone, without touching other players, apples, or free cells:
+	void predict_player(uint32_t i, float elapsed);
+
 	//constants:
 	//the update rate on the server:
 	inline static constexpr float Tick = 1.0f / 30.0f;
@@ -140,12 +407,79 @@ struct Game {
 	//---- communication helpers ----
 
 	//used by client:
-	//set game state from data in connection buffer
+	//set game state from data in connection buffer (along with the S2C_You message that precedes it)
+	//  The client's own player (if it has one) ends up in slot 0.
+	//  Acknowledges the state's tick to the server (so later states can be sent relative to it).
+	//  Compressed states (S2C_Deflated) are expanded in the buffer first, then read the same way.
 	// (return true if data was read)
 	bool recv_state_message(Connection *connection);
+	//ask the server to compress states (a persistent stream per connection; worthwhile on slow links), ready to expand them:
+	void send_deflate_request_message(Connection *connection);
+	std::unique_ptr< InflateStream > inflater; //(nullptr until compression was asked for)
+	//states received that the server may send later states relative to (oldest first):
+	std::deque< Snapshot > received;
+	//read a map info / map download message; downloads go into 'map' (and the cache, once complete)
+	//  If the server's map isn't the current one or in the cache, asks the server for it.
+	// (return true if data was read)
+	bool recv_map_message(Connection *connection);
+	//used by client (prediction):
+	//record one tick's controls (numbered by client tick) and apply them right away to this client's player (slot 0);
+	//  a controls message goes out only for InputRepeatTicks after they change (or every InputKeepaliveTicks, so the
+	//  server can keep its InputTimeline lined up), carrying the last InputRedundancy changes so a lost message loses nothing.
+	//  Inputs are kept until a state shows the server has applied them, and replayed on top of each state until then.
+	void send_input(Connection *connection, Player::Controls const &controls);
+	std::deque< Player::Input > pending_inputs; //every tick's input, oldest first
+	std::deque< Player::Input > sent_inputs; //latest changes (repeated in each controls message), oldest first
+	inline static constexpr uint32_t MaxPendingInputs = 64;
+	inline static constexpr uint32_t InputRedundancy = sizeof(InputTimeline::ControlsMessage::inputs) / sizeof(Player::Input);
+	inline static constexpr uint32_t InputRepeatTicks = 3;
+	inline static constexpr uint32_t InputKeepaliveTicks = 6;
+	uint32_t next_input_seq = 1;
+	uint32_t last_controls_message_seq = 0; //tick of the last controls message sent (0 => none yet)
+	uint64_t controls_messages_sent = 0;
+	bool have_own_player = false; //did the last state include this client's player (in slot 0)?
+	uint32_t next_player_id = 0; //for Snapshot::PlayerState::handle on clients
+	//downloaded maps are saved here as <hash>.map, so rejoining the same arena needs no download ("" => no cache):
+	std::string map_cache_dir;
+	uint64_t map_requested = 0; //hash of map asked for (0 => none)
+	void send_map_request_message(Connection *connection, uint64_t hash);
+
+	//used by server:
+	//say which map is in use (when a client joins):
+	void send_map_info_message(Connection *connection) const;
+	//send the whole map, chunk by chunk (when a client asks for it):
+	void send_map_message(Connection *connection) const;
+	//read a request for the map (C2S_MapRequest):
+	// (returns true if a message was read, throws on malformed message)
+	static bool recv_map_request_message(Connection *connection, uint64_t *hash);
+	//read a request for compressed states (C2S_Deflate):
+	// (returns true if a message was read, throws on malformed message)
+	static bool recv_deflate_request_message(Connection *connection);
+
+	//used by server:
+	//remember the current state (call after each update, before encoding state messages):
+	void record_snapshot();
+	inline static constexpr uint32_t HistoryTicks = 32; //number of recorded states kept
+	std::deque< Snapshot > history; //oldest first
+	Snapshot const *snapshot_at(uint32_t tick) const; //(nullptr if not in history)
 
 	//used by server:
-	//send game state.
-	//  Will move "connection_player" to the front of the front of the sent list.
-	void send_state_message(Connection *connection, Player *connection_player = nullptr) const;
+	//build the state message for the latest recorded snapshot, as the differences from 'baseline_tick'
+	//  (or the whole state if baseline_tick isn't in history). Clients that acknowledged the same tick
+	//  get the same bytes, so this only needs to happen once per distinct baseline.
+	SharedBytes encode_state_message(uint32_t baseline_tick = NoTick) const;
+	//(controls messages are read by InputTimeline::recv_controls_message)
+	//read an acknowledgement (C2S_Ack) of a state tick:
+	// (returns true if a message was read, throws on malformed message)
+	static bool recv_ack_message(Connection *connection, uint32_t *tick);
+	//send game state built by encode_state_message (queued by reference, not copied),
+	//  preceded by a small S2C_You message saying which player is "connection_player", the client tick
+	//  its inputs have been applied up to (InputTimeline::applied), and the parts of its state the client needs to predict its movement.
+	void send_state_message(Connection *connection, SharedBytes const &state, Player::Handle connection_player = Player::Handle(), uint32_t input_seq = 0) const;
+	inline static constexpr uint8_t YouSize = 16; //payload bytes of S2C_You
+	//just the S2C_You message (4 + YouSize bytes), for sending along with a state some other way (see NetThread):
+	void encode_you_message(Player::Handle connection_player, uint32_t input_seq, uint8_t *header) const;
+	//an S2C_You message (from encode_you_message) and state, compressed into an S2C_Deflated message on a connection's stream:
+	//  Unlike the shared state, this belongs to one connection, and (as the stream goes on from it) must not be dropped.
+	static SharedBytes encode_deflated_message(DeflateStream *stream, uint8_t const *header, SharedBytes const &state);
 };
@@ -0,0 +1,132 @@
+#pragma once
+
+/*
+ * Bounded lock-free queues, for handing items between threads without
+ * either side ever waiting on the other:
+ *
+ *   SpscQueue< Item > queue(1024); //exactly one producer thread and one consumer thread
+ *   if (!queue.try_push(std::move(item))) ...full: the producer decides what to do
+ *   Item got;
+ *   while (queue.try_pop(&got)) ...
+ *
+ * MpscQueue has the same interface, but any number of threads may push
+ * (e.g., one task per match), still with a single consumer.
+ * Capacities are rounded up to a power of two. Popped slots keep their
+ * moved-from items until overwritten, so items should be cheap to move.
+ */
+
+#include <vector>
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <utility>
+
+//(keeps the producer's and consumer's counters on separate cache lines)
+#define LOCK_FREE_QUEUE_LINE 64
+
+template< typename T >
+struct SpscQueue {
+	SpscQueue(size_t capacity) {
+		size_t size = 2;
+		while (size < capacity) size *= 2;
+		items.resize(size);
+		mask = size - 1;
+	}
+
+	//(producer only) returns false if the queue is full:
+	bool try_push(T &&item) {
+		size_t at = tail.load(std::memory_order_relaxed);
+		if (at - head_cache > mask) {
+			head_cache = head.load(std::memory_order_acquire);
+			if (at - head_cache > mask) return false;
+		}
+		items[at & mask] = std::move(item);
+		tail.store(at + 1, std::memory_order_release);
+		return true;
+	}
+
+	//(consumer only) returns false if the queue is empty:
+	bool try_pop(T *item) {
+		assert(item);
+		size_t at = head.load(std::memory_order_relaxed);
+		if (at == tail_cache) {
+			tail_cache = tail.load(std::memory_order_acquire);
+			if (at == tail_cache) return false;
+		}
+		*item = std::move(items[at & mask]);
+		head.store(at + 1, std::memory_order_release);
+		return true;
+	}
+
+	//internals:
+	std::vector< T > items;
+	size_t mask = 0;
+	alignas(LOCK_FREE_QUEUE_LINE) std::atomic< size_t > head{0}; //next slot to pop
+	size_t tail_cache = 0; //(consumer's last look at tail)
+	alignas(LOCK_FREE_QUEUE_LINE) std::atomic< size_t > tail{0}; //next slot to push
+	size_t head_cache = 0; //(producer's last look at head)
+};
+
+//each slot carries a sequence number saying whose turn it is: producers claim a slot by
+// advancing 'tail' with a compare-exchange, then publish it by bumping the slot's sequence
+// (after D. Vyukov's bounded MPMC queue, with the consumer side simplified to one thread):
+template< typename T >
+struct MpscQueue {
+	MpscQueue(size_t capacity) : slots(round_up(capacity)) {
+		mask = slots.size() - 1;
+		for (size_t i = 0; i < slots.size(); ++i) {
+			slots[i].sequence.store(i, std::memory_order_relaxed);
+		}
+	}
+
+	//(any thread) returns false if the queue is full:
+	bool try_push(T &&item) {
+		size_t at = tail.load(std::memory_order_relaxed);
+		Slot *slot;
+		while (true) {
+			slot = &slots[at & mask];
+			size_t sequence = slot->sequence.load(std::memory_order_acquire);
+			intptr_t turn = intptr_t(sequence) - intptr_t(at);
+			if (turn == 0) {
+				//slot is free for position 'at'; claim it (or see who did and try the next one):
+				if (tail.compare_exchange_weak(at, at + 1, std::memory_order_relaxed)) break;
+			} else if (turn < 0) {
+				//(slot still holds an item from a lap ago)
+				return false;
+			} else {
+				at = tail.load(std::memory_order_relaxed);
+			}
+		}
+		slot->item = std::move(item);
+		slot->sequence.store(at + 1, std::memory_order_release);
+		return true;
+	}
+
+	//(consumer only) returns false if the queue is empty (or the next item isn't published yet):
+	bool try_pop(T *item) {
+		assert(item);
+		Slot &slot = slots[head & mask];
+		if (slot.sequence.load(std::memory_order_acquire) != head + 1) return false;
+		*item = std::move(slot.item);
+		//free for the producer one lap later:
+		slot.sequence.store(head + mask + 1, std::memory_order_release);
+		head += 1;
+		return true;
+	}
+
+	//internals:
+	struct Slot {
+		std::atomic< size_t > sequence{0};
+		T item;
+	};
+	static size_t round_up(size_t capacity) {
+		size_t size = 2;
+		while (size < capacity) size *= 2;
+		return size;
+	}
+	std::vector< Slot > slots;
+	size_t mask = 0;
+	alignas(LOCK_FREE_QUEUE_LINE) std::atomic< size_t > tail{0}; //next position to claim
+	alignas(LOCK_FREE_QUEUE_LINE) size_t head = 0; //next position to pop (consumer only)
+};
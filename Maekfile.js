@@ -30,6 +30,7 @@ if (maek.OS === "windows") {
 		`/I${NEST_LIBS}/SDL2/include`,
 		`/I${NEST_LIBS}/glm/include`,
 		`/I${NEST_LIBS}/libpng/include`,
+		`/I${NEST_LIBS}/zlib/include`,
 		`/I${NEST_LIBS}/opusfile/include`,
 		`/I${NEST_LIBS}/libopus/include`,
 		`/I${NEST_LIBS}/libogg/include`,
@@ -60,6 +61,7 @@ if (maek.OS === "windows") {
 		`-I${NEST_LIBS}/SDL2/include/SDL2`, `-D_THREAD_SAFE`, //the output of sdl-config --cflags
 		`-I${NEST_LIBS}/glm/include`,
 		`-I${NEST_LIBS}/libpng/include`,
+		`-I${NEST_LIBS}/zlib/include`,
 		`-I${NEST_LIBS}/opusfile/include`,
 		`-I${NEST_LIBS}/libopus/include`,
 		`-I${NEST_LIBS}/libogg/include`,
@@ -84,6 +86,7 @@ if (maek.OS === "windows") {
 		`-I${NEST_LIBS}/SDL2/include/SDL2`, `-D_THREAD_SAFE`, //the output of sdl-config --cflags
 		`-I${NEST_LIBS}/glm/include`, `-Wno-deprecated-declarations`, //because of vsprintf in string_cast
 		`-I${NEST_LIBS}/libpng/include`,
+		`-I${NEST_LIBS}/zlib/include`,
 		`-I${NEST_LIBS}/opusfile/include`,
 		`-I${NEST_LIBS}/libopus/include`,
 		`-I${NEST_LIBS}/libogg/include`,
@@ -128,9 +131,12 @@ if (maek.OS === 'windows') {
 // cppFile: name of c++ file to compile
 // objFileBase (optional): base name object file to produce (if not supplied, set to options.objDir + '/' + cppFile without the extension)
 //returns objFile: objFileBase + a platform-dependant suffix ('.o' or '.obj')
+const snapshot_buffer_obj = maek.CPP('SnapshotBuffer.cpp'); //(also linked into snapshotbuffer-bench)
+
 const client_names = [
 	maek.CPP('client.cpp'),
 	maek.CPP('PlayMode.cpp'),
+	snapshot_buffer_obj,
 	maek.CPP('LitColorTextureProgram.cpp'),
 	//maek.CPP('ColorTextureProgram.cpp'),  //not used right now, but you might want it
 	maek.CPP('Sound.cpp'),
@@ -139,11 +145,57 @@ const client_names = [
 ];
 
 const server_names = [
-	maek.CPP('server.cpp')
+	maek.CPP('server.cpp'),
+	maek.CPP('NetThread.cpp')
 ];
 
-const common_names = [
+const loadgen_names = [
+	maek.CPP('loadgen.cpp')
+];
+
+//tests and benchmarks (each links only what it exercises, so shared objects are made once here):
+const body_codec_obj = maek.CPP('BodyCodec.cpp');
+const connection_obj = maek.CPP('Connection.cpp');
+const game_objs = [
 	maek.CPP('Game.cpp'),
+	maek.CPP('WorkerPool.cpp'),
+	maek.CPP('Profiler.cpp'),
+	body_codec_obj,
+	maek.CPP('StateDeflate.cpp')
+];
+
+const bytequeue_bench_names = [
+	maek.CPP('bytequeue-bench.cpp')
+];
+
+const bodycodec_test_names = [
+	maek.CPP('bodycodec-test.cpp'),
+	body_codec_obj
+];
+
+const bodycodec_bench_names = [
+	maek.CPP('bodycodec-bench.cpp'),
+	body_codec_obj
+];
+
+const snapshotbuffer_bench_names = [
+	maek.CPP('snapshotbuffer-bench.cpp'),
+	snapshot_buffer_obj
+];
+
+const udp_loopback_test_names = [
+	maek.CPP('udp-loopback-test.cpp'),
+	connection_obj
+];
+
+const state_delta_test_names = [
+	maek.CPP('state-delta-test.cpp'),
+	...game_objs,
+	connection_obj
+];
+
+const common_names = [
+	...game_objs,
 	maek.CPP('data_path.cpp'),
 	maek.CPP('PathFont.cpp'),
 	maek.CPP('PathFont-font.cpp'),
@@ -156,7 +208,7 @@ const common_names = [
 	maek.CPP('Mode.cpp'),
 	maek.CPP('GL.cpp'),
 	maek.CPP('Load.cpp'),
-	maek.CPP('Connection.cpp'),
+	connection_obj,
 	maek.CPP('hex_dump.cpp')
 ];
 
@@ -178,11 +230,18 @@ const show_scene_names = [
 //returns exeFile: exeFileBase + a platform-dependant suffix (e.g., '.exe' on windows)
 const client_exe = maek.LINK([...client_names, ...common_names], 'dist/client');
 const server_exe = maek.LINK([...server_names, ...common_names], 'dist/server');
+const loadgen_exe = maek.LINK([...loadgen_names, ...common_names], 'dist/loadgen');
+const bytequeue_bench_exe = maek.LINK([...bytequeue_bench_names], 'dist/bytequeue-bench');
+const bodycodec_test_exe = maek.LINK([...bodycodec_test_names], 'dist/bodycodec-test');
+const bodycodec_bench_exe = maek.LINK([...bodycodec_bench_names], 'dist/bodycodec-bench');
+const snapshotbuffer_bench_exe = maek.LINK([...snapshotbuffer_bench_names], 'dist/snapshotbuffer-bench');
+const udp_loopback_test_exe = maek.LINK([...udp_loopback_test_names], 'dist/udp-loopback-test');
+const state_delta_test_exe = maek.LINK([...state_delta_test_names], 'dist/state-delta-test');
 const show_meshes_exe = maek.LINK([...show_meshes_names, ...common_names], 'scenes/show-meshes');
 const show_scene_exe = maek.LINK([...show_scene_names, ...common_names], 'scenes/show-scene');
 
 //set the default target to the game (and copy the readme files):
-maek.TARGETS = [client_exe, server_exe, show_meshes_exe, show_scene_exe, ...copies];
+maek.TARGETS = [client_exe, server_exe, loadgen_exe, bytequeue_bench_exe, bodycodec_test_exe, bodycodec_bench_exe, snapshotbuffer_bench_exe, udp_loopback_test_exe, state_delta_test_exe, show_meshes_exe, show_scene_exe, ...copies];
 
 //Note that tasks that produce ':abstract targets' are never cached.
 // This is similar to how .PHONY targets behave in make.
@@ -0,0 +1,251 @@
+#include "NetThread.hpp"
+
+#include <iostream>
+#include <vector>
+#include <utility>
+#include <cstring>
+#include <cassert>
+
+NetThread::NetThread(std::string const &port, Transport transport, double drop_rate, PollBackend backend, SendLimits limits_)
+	: server(port, transport, backend), events(1 << 14), outgoing(1 << 16), limits(limits_) {
+	server.poller.drop_rate = drop_rate;
+	thread = std::thread([this](){ run(); });
+}
+
+NetThread::~NetThread() {
+	quit.store(true);
+	server.wake();
+	thread.join();
+}
+
+bool NetThread::pop(Event *event) {
+	return events.try_pop(event);
+}
+
+void NetThread::push(Outgoing &&item) {
+	//once something has gone to 'overflow', later sends follow it there (so sends stay in order):
+	if (!overflowed.load(std::memory_order_acquire) && outgoing.try_push(std::move(item))) return;
+	if (item.kind == Outgoing::SendDroppable) {
+		droppable_dropped.fetch_add(1, std::memory_order_relaxed);
+		return;
+	}
+	send_overflows.fetch_add(1, std::memory_order_relaxed);
+	std::lock_guard< std::mutex > lock(overflow_mutex);
+	overflow.emplace_back(std::move(item));
+	overflowed.store(true, std::memory_order_release);
+}
+
+void NetThread::send(uint32_t id, SharedBytes const &bytes) {
+	assert(bytes);
+	Outgoing item;
+	item.kind = Outgoing::Send;
+	item.id = id;
+	item.bytes = bytes;
+	push(std::move(item));
+}
+
+void NetThread::send_droppable(uint32_t id, void const *prefix, size_t prefix_size, SharedBytes const &bytes) {
+	assert(bytes);
+	assert(prefix_size <= sizeof(Outgoing::prefix));
+	Outgoing item;
+	item.kind = Outgoing::SendDroppable;
+	item.id = id;
+	item.prefix_size = uint8_t(prefix_size);
+	std::memcpy(item.prefix, prefix, prefix_size);
+	item.bytes = bytes;
+	push(std::move(item));
+}
+
+void NetThread::send(uint32_t id, Connection &staging) {
+	assert(!staging.poller); //(meant for connections that are just buffers)
+	if (staging.send_pending() == 0) return;
+	auto bytes = std::make_shared< std::vector< uint8_t > >();
+	bytes->reserve(staging.send_pending());
+	Connection::Piece pieces[16];
+	while (size_t count = staging.peek_send(pieces, 16)) {
+		size_t total = 0;
+		for (size_t i = 0; i < count; ++i) {
+			bytes->insert(bytes->end(), pieces[i].data, pieces[i].data + pieces[i].size);
+			total += pieces[i].size;
+		}
+		staging.consume_send(total);
+	}
+	send(id, bytes);
+}
+
+void NetThread::close(uint32_t id) {
+	Outgoing item;
+	item.kind = Outgoing::Close;
+	item.id = id;
+	push(std::move(item));
+}
+
+void NetThread::flush() {
+	server.wake();
+}
+
+//---------------------------------
+//network thread:
+
+void NetThread::emit(Event const &event) {
+	//(events are never dropped; if the simulation is behind, they wait here in order)
+	if (backlog.empty()) {
+		Event copy = event;
+		if (events.try_push(std::move(copy))) return;
+	}
+	events_delayed.fetch_add(1, std::memory_order_relaxed);
+	backlog.emplace_back(event);
+}
+
+void NetThread::handle_outgoing(Outgoing &&item) {
+	auto f = by_id.find(item.id);
+	if (f == by_id.end()) return; //(connection already gone)
+	Connection *c = f->second;
+	if (item.kind == Outgoing::Send) {
+		c->send_shared(item.bytes);
+	} else if (item.kind == Outgoing::SendDroppable) {
+		c->send_droppable(item.prefix, item.prefix_size, item.bytes);
+	} else { assert(item.kind == Outgoing::Close);
+		c->close();
+		ids.erase(c);
+		by_id.erase(f);
+		Event event;
+		event.kind = Event::Close;
+		event.id = item.id;
+		emit(event);
+	}
+}
+
+void NetThread::close_slow_clients() {
+	auto now = std::chrono::steady_clock::now();
+	if (now < next_slow_check) return;
+	next_slow_check = now + std::chrono::milliseconds(250);
+
+	std::vector< std::pair< uint32_t, Connection * > > slow;
+	std::unordered_map< uint32_t, Stall > still_waiting;
+	for (auto const &[id, c] : by_id) {
+		if (c->send_pending() == 0) continue;
+		if (c->send_pending() > limits.queued_bytes) {
+			std::cout << "Disconnecting client: " << c->send_pending() << " bytes waiting to be sent." << std::endl;
+			slow.emplace_back(id, c);
+			continue;
+		}
+		Stall stall;
+		stall.bytes_sent = c->bytes_sent;
+		stall.since = now;
+		auto f = stalls.find(id);
+		if (f != stalls.end() && f->second.bytes_sent == c->bytes_sent) stall = f->second; //(nothing sent since)
+		if (std::chrono::duration< double >(now - stall.since).count() > limits.stall_seconds) {
+			std::cout << "Disconnecting client: nothing sent for " << limits.stall_seconds << " seconds." << std::endl;
+			slow.emplace_back(id, c);
+			continue;
+		}
+		still_waiting.emplace(id, stall);
+	}
+	stalls = std::move(still_waiting);
+
+	for (auto const &[id, c] : slow) {
+		c->close();
+		by_id.erase(id);
+		ids.erase(c);
+		slow_closed.fetch_add(1, std::memory_order_relaxed);
+		Event event;
+		event.kind = Event::Close;
+		event.id = id;
+		emit(event);
+	}
+}
+
+void NetThread::run() {
+	std::deque< Outgoing > from_overflow;
+	while (!quit.load()) {
+		//hand over events the simulation didn't have room for:
+		while (!backlog.empty()) {
+			Event event = backlog.front();
+			if (!events.try_push(std::move(event))) break;
+			backlog.pop_front();
+		}
+
+		//queue up everything the simulation has sent since the last pass:
+		Outgoing item;
+		while (outgoing.try_pop(&item)) {
+			handle_outgoing(std::move(item));
+		}
+		if (overflowed.load(std::memory_order_acquire)) {
+			{
+				std::lock_guard< std::mutex > lock(overflow_mutex);
+				std::swap(from_overflow, overflow);
+				overflowed.store(false, std::memory_order_release);
+			}
+			for (auto &sent : from_overflow) {
+				handle_outgoing(std::move(sent));
+			}
+			from_overflow.clear();
+		}
+
+		close_slow_clients();
+
+		//(a short wait while events are backed up, so they're handed over soon after the simulation catches up,
+		// or if flush() can't interrupt the wait)
+		double timeout = (backlog.empty() && server.poller.wake_send != InvalidSocket ? 0.1 : 0.001);
+		server.poll([this](Connection *c, Connection::Event evt){
+			if (evt == Connection::OnOpen) {
+				uint32_t id = next_id++;
+				by_id.emplace(id, c);
+				ids.emplace(c, id);
+				Event event;
+				event.kind = Event::Open;
+				event.id = id;
+				emit(event);
+			} else if (evt == Connection::OnClose) {
+				auto f = ids.find(c);
+				if (f == ids.end()) return;
+				Event event;
+				event.kind = Event::Close;
+				event.id = f->second;
+				by_id.erase(f->second);
+				ids.erase(f);
+				emit(event);
+			} else { assert(evt == Connection::OnRecv);
+				auto f = ids.find(c);
+				if (f == ids.end()) return;
+				Event event;
+				event.id = f->second;
+				try {
+					bool handled_message;
+					do {
+						handled_message = false;
+						if (InputTimeline::recv_controls_message(c, &event.controls)) {
+							handled_message = true;
+							event.kind = Event::Controls;
+							emit(event);
+						}
+						if (Game::recv_map_request_message(c, &event.map_hash)) {
+							handled_message = true;
+							event.kind = Event::MapRequest;
+							emit(event);
+						}
+						if (Game::recv_ack_message(c, &event.tick)) {
+							handled_message = true;
+							event.kind = Event::Ack;
+							emit(event);
+						}
+						if (Game::recv_deflate_request_message(c)) {
+							handled_message = true;
+							event.kind = Event::Deflate;
+							emit(event);
+						}
+						//TODO: extend for more message types as needed
+					} while (handled_message);
+				} catch (std::exception const &e) {
+					std::cout << "Disconnecting client:" << e.what() << std::endl;
+					c->close();
+					by_id.erase(f->second);
+					ids.erase(f);
+					event.kind = Event::Close;
+					emit(event);
+				}
+			}
+		}, timeout);
+	}
+}
@@ -0,0 +1,123 @@
+#pragma once
+
+/*
+ * NetThread runs a Server's socket work (polling, reading, framing and
+ * parsing client messages, writing) on a thread of its own, so the
+ * simulation never waits on a socket, and a burst of incoming data or
+ * connections doesn't push back the next tick:
+ *
+ *   NetThread net(port, transport);
+ *   ...each tick, on the simulation thread:
+ *   NetThread::Event event;
+ *   while (net.pop(&event)) ...opens, closes, and parsed client messages, in order
+ *   ...from any thread (e.g., one task per match):
+ *   net.send_droppable(event.id, header, sizeof(header), state);
+ *   ...once the tick's sends are queued:
+ *   net.flush();
+ *
+ * The two sides only share lock-free queues (one producer -> one consumer
+ * for events, many -> one for sends); connections are named by id and
+ * only ever touched by the network thread.
+ */
+
+#include "Connection.hpp"
+#include "Game.hpp"
+#include "LockFreeQueue.hpp"
+
+#include <thread>
+#include <atomic>
+#include <mutex>
+#include <deque>
+#include <string>
+#include <unordered_map>
+#include <chrono>
+#include <cstdint>
+
+//when NetThread gives up on a client that isn't keeping up:
+// (stale states are dropped for slow clients anyway -- see Connection::send_droppable -- so the bytes
+//  that pile up are everything else, e.g., maps, plus the newest state)
+struct SendLimits {
+	size_t queued_bytes = size_t(32) << 20; //close connections with more than this waiting to be sent
+	double stall_seconds = 10.0; //close connections that have had bytes waiting, but taken none, this long
+};
+
+struct NetThread {
+	NetThread(std::string const &port, Transport transport = Transport::TCP, double drop_rate = 0.0, PollBackend backend = PollBackend::Readiness, SendLimits limits = SendLimits());
+	~NetThread(); //(stops the network thread)
+
+	//something that happened on a connection:
+	struct Event {
+		enum Kind : uint8_t {
+			Open, //new connection
+			Close, //connection gone (closed by the client, an error, a malformed message, or close())
+			Controls, //C2S_Controls, in 'controls'
+			Ack, //C2S_Ack, of 'tick'
+			MapRequest, //C2S_MapRequest, for 'map_hash'
+			Deflate, //C2S_Deflate
+		} kind = Open;
+		uint32_t id = 0; //connection (never reused)
+		uint32_t tick = 0;
+		uint64_t map_hash = 0;
+		InputTimeline::ControlsMessage controls;
+	};
+	//(simulation thread) next event, if any (returns false if none):
+	bool pop(Event *event);
+
+	//(any thread) queue bytes to send on a connection, never blocking:
+	// (sends to connections that have since closed are ignored)
+	void send(uint32_t id, SharedBytes const &bytes);
+	//(as Connection::send_droppable; these are simply dropped if the network thread is too far behind)
+	void send_droppable(uint32_t id, void const *prefix, size_t prefix_size, SharedBytes const &bytes);
+	//everything queued on a Connection that isn't attached to a socket (e.g., filled by Game::send_map_message):
+	void send(uint32_t id, Connection &staging);
+	void close(uint32_t id);
+	//let the network thread know sends are waiting (e.g., once a tick's states are all queued):
+	void flush();
+
+	//stats (counted since start):
+	std::atomic< uint64_t > droppable_dropped{0}; //droppable sends that found the send queue full
+	std::atomic< uint64_t > send_overflows{0}; //other sends that found it full (they wait in 'overflow' instead)
+	std::atomic< uint64_t > events_delayed{0}; //events that found the event queue full (they wait in 'backlog')
+	std::atomic< uint64_t > slow_closed{0}; //connections closed for going past 'limits'
+
+	//internals:
+	struct Outgoing {
+		enum Kind : uint8_t { Send, SendDroppable, Close } kind = Send;
+		uint32_t id = 0;
+		uint8_t prefix_size = 0;
+		uint8_t prefix[4 + Game::YouSize]; //(SendDroppable)
+		SharedBytes bytes;
+	};
+	void push(Outgoing &&outgoing);
+
+	Server server;
+	SpscQueue< Event > events; //network thread -> simulation
+	MpscQueue< Outgoing > outgoing; //anyone -> network thread
+
+	//(rare) sends that didn't fit in 'outgoing'; kept in order, and handled before anything newer:
+	std::mutex overflow_mutex;
+	std::deque< Outgoing > overflow;
+	std::atomic< bool > overflowed{false};
+
+	//network thread only:
+	void run();
+	void handle_outgoing(Outgoing &&outgoing);
+	void emit(Event const &event);
+	std::deque< Event > backlog; //events that didn't fit in 'events' yet
+	std::unordered_map< uint32_t, Connection * > by_id;
+	std::unordered_map< Connection *, uint32_t > ids;
+	uint32_t next_id = 1;
+
+	//slow clients (checked a few times a second):
+	SendLimits limits;
+	void close_slow_clients();
+	struct Stall {
+		uint64_t bytes_sent = 0; //Connection::bytes_sent when it was first seen with bytes waiting...
+		std::chrono::steady_clock::time_point since; //...at this time
+	};
+	std::unordered_map< uint32_t, Stall > stalls; //connections with bytes waiting, by id
+	std::chrono::steady_clock::time_point next_slow_check;
+
+	std::atomic< bool > quit{false};
+	std::thread thread;
+};
@@ -7,10 +7,12 @@
 #include "Mesh.hpp"
 
 #include <glm/gtc/type_ptr.hpp>
+#include <glm/gtc/matrix_transform.hpp>
 #include <glm/gtx/string_cast.hpp>
 
 #include <random>
 #include <array>
+#include <algorithm>
 
 
 GLuint snake_meshes_for_lit_color_texture_program = 0;
@@ -48,6 +50,15 @@ PlayMode::PlayMode(Client &client_) : client(client_), scene(*snake_scene) {
 		else if (drawable.transform->name == "Apple") applePrefab = drawable.pipeline;
 	}
 
+	//camera follows the local snake (see draw):
+	scene.transforms.emplace_back();
+	scene.transforms.back().name = "FollowCamera";
+	scene.cameras.emplace_back(&scene.transforms.back());
+	camera = &scene.cameras.back();
+
+	//maps downloaded from servers are kept here, so rejoining the same arena skips the download:
+	game.map_cache_dir = data_path("map-cache");
+
 	//send/receive data:
 	client.poll([this](Connection *c, Connection::Event event){
 		if (event == Connection::OnOpen) {
@@ -56,12 +67,19 @@ PlayMode::PlayMode(Client &client_) : client(client_), scene(*snake_scene) {
 			std::cout << "[" << c->socket << "] closed (!)" << std::endl;
 			throw std::runtime_error("Lost connection to server!");
 		} else { assert(event == Connection::OnRecv);
-			//std::cout << "[" << c->socket << "] recv'd data. Current buffer:\n" << hex_dump(c->recv_buffer); std::cout.flush(); //DEBUG
+			//std::cout << "[" << c->socket << "] recv'd data. Current buffer:\n" << hex_dump(c->recv_buffer.data(), c->recv_buffer.size()); std::cout.flush(); //DEBUG
 			bool handled_message;
 			try {
 				do {
 					handled_message = false;
-					if (game.recv_state_message(c)) handled_message = true;
+					if (game.recv_state_message(c)) {
+						handled_message = true;
+						remote.push(game.received.back());
+					}
+					if (game.recv_map_message(c)) {
+						handled_message = true;
+						map_changed = true;
+					}
 				} while (handled_message);
 			} catch (std::exception const &e) {
 				std::cerr << "[" << c->socket << "] malformed message from server: " << e.what() << std::endl;
@@ -71,11 +89,28 @@ PlayMode::PlayMode(Client &client_) : client(client_), scene(*snake_scene) {
 		}
 	}, 0.0);
 
-	assert(game.map.width*game.map.height > 0);
-	for (uint32_t y = 0; y < game.map.height; y++) {
-		for(uint32_t x = 0; x < game.map.width; x++) {
+	//everything after this in scene.drawables is map geometry (rebuilt when the map arrives):
+	static_drawables = scene.drawables.size();
+	rebuild_map_drawables();
+}
+
+void PlayMode::rebuild_map_drawables() {
+	map_changed = false;
+
+	//remove the old map geometry:
+	auto first_map_drawable = scene.drawables.begin();
+	std::advance(first_map_drawable, static_drawables);
+	scene.drawables.erase(first_map_drawable, scene.drawables.end());
+	map_transforms.clear();
+
+	//only the chunks near map_focus_chunk:
+	glm::ivec2 from = glm::max(map_focus_chunk - glm::ivec2(MapDrawRadius), glm::ivec2(0)) * int32_t(Map::ChunkSize);
+	glm::ivec2 to = glm::min((map_focus_chunk + glm::ivec2(MapDrawRadius + 1)) * int32_t(Map::ChunkSize), glm::ivec2(int32_t(game.map.width), int32_t(game.map.height)));
+	for (int32_t y = from.y; y < to.y; y++) {
+		for(int32_t x = from.x; x < to.x; x++) {
 			MapBlock block = game.map.grid_idx(x, y);
-			Scene::Transform transform;
+			map_transforms.emplace_back();
+			Scene::Transform &transform = map_transforms.back();
 			transform.position = glm::vec3(float(x), float(y), 0.0f);
 			Scene::Drawable::Pipeline pipeline;
 			if(block == G) {
@@ -92,15 +127,14 @@ PlayMode::PlayMode(Client &client_) : client(client_), scene(*snake_scene) {
 			} else if (block == UL) {
 				pipeline = barrierCornerPrefab;
 				transform.rotation *= glm::angleAxis(90.0f, glm::vec3(0.0f, 0.0f, 1.0f));
-			} else if (block == UL) {
+			} else if (block == DL) {
 				pipeline = barrierCornerPrefab;
 				transform.rotation *= glm::angleAxis(180.0f, glm::vec3(0.0f, 0.0f, 1.0f));
-			} else if (block == UL) {
+			} else if (block == DR) {
 				pipeline = barrierCornerPrefab;
 				transform.rotation *= glm::angleAxis(270.0f, glm::vec3(0.0f, 0.0f, 1.0f));
 			}
-			scene.transforms.emplace_back(transform);
-			Scene::Drawable drawable(&scene.transforms.back());
+			Scene::Drawable drawable(&transform);
 			scene.drawables.emplace_back(drawable);
 			scene.drawables.back().pipeline = pipeline;
 		}
@@ -109,6 +143,13 @@ PlayMode::PlayMode(Client &client_) : client(client_), scene(*snake_scene) {
 
 }
 
+void PlayMode::add_dynamic_drawable(glm::vec3 const &position, Scene::Drawable::Pipeline const &pipeline) {
+	dynamic_transforms.emplace_back();
+	dynamic_transforms.back().position = position;
+	scene.drawables.emplace_back(&dynamic_transforms.back());
+	scene.drawables.back().pipeline = pipeline;
+}
+
 PlayMode::~PlayMode() {
 }
 
@@ -162,15 +203,21 @@ bool PlayMode::handle_event(SDL_Event const &evt, glm::uvec2 const &window_size)
 
 void PlayMode::update(float elapsed) {
 
-	//queue data for sending to server:
-	controls.send_controls_message(&client.connection);
-
-	//reset button press counters:
-	controls.left.downs = 0;
-	controls.right.downs = 0;
-	controls.up.downs = 0;
-	controls.down.downs = 0;
-	controls.jump.downs = 0;
+	//sample controls (and predict the local snake's movement from them) at the server's tick rate:
+	// (they only go out to the server when they change; the server echoes the last client tick it applied in
+	//  each state, and later inputs are replayed on top; see Game::send_input)
+	input_accumulator = std::min(input_accumulator + elapsed, 4.0f * Game::Tick); //(don't try to catch up after a long hitch)
+	while (input_accumulator >= Game::Tick) {
+		input_accumulator -= Game::Tick;
+		game.send_input(&client.connection, controls);
+
+		//reset button press counters:
+		controls.left.downs = 0;
+		controls.right.downs = 0;
+		controls.up.downs = 0;
+		controls.down.downs = 0;
+		controls.jump.downs = 0;
+	}
 
 	//send/receive data:
 	client.poll([this](Connection *c, Connection::Event event){
@@ -180,12 +227,19 @@ void PlayMode::update(float elapsed) {
 			std::cout << "[" << c->socket << "] closed (!)" << std::endl;
 			throw std::runtime_error("Lost connection to server!");
 		} else { assert(event == Connection::OnRecv);
-			//std::cout << "[" << c->socket << "] recv'd data. Current buffer:\n" << hex_dump(c->recv_buffer); std::cout.flush(); //DEBUG
+			//std::cout << "[" << c->socket << "] recv'd data. Current buffer:\n" << hex_dump(c->recv_buffer.data(), c->recv_buffer.size()); std::cout.flush(); //DEBUG
 			bool handled_message;
 			try {
 				do {
 					handled_message = false;
-					if (game.recv_state_message(c)) handled_message = true;
+					if (game.recv_state_message(c)) {
+						handled_message = true;
+						remote.push(game.received.back());
+					}
+					if (game.recv_map_message(c)) {
+						handled_message = true;
+						map_changed = true;
+					}
 				} while (handled_message);
 			} catch (std::exception const &e) {
 				std::cerr << "[" << c->socket << "] malformed message from server: " << e.what() << std::endl;
@@ -194,6 +248,10 @@ void PlayMode::update(float elapsed) {
 			}
 		}
 	}, 0.0);
+
+	if (map_changed) rebuild_map_drawables();
+
+	remote.advance(elapsed);
 }
 
 void PlayMode::draw(glm::uvec2 const &drawable_size) {
@@ -218,7 +276,60 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 
 	GL_ERRORS(); //print any errors produced by this setup code
 
-	scene.draw(*camera);
+	{ //snakes and apples go after the map geometry for this frame only:
+		//the camera looks at this client's snake (or, until it has one, the middle of the map):
+		bool have_snake = game.have_own_player && !game.players.body[0].empty();
+		glm::vec3 focus = glm::vec3(0.5f * float(game.map.width), 0.5f * float(game.map.height), 0.0f);
+		if (have_snake) focus = glm::vec3(game.players.body[0].back()) + glm::vec3(0.0f, 0.0f, 1.0f + game.players.zHeight[0]);
+
+		//map geometry follows the camera a chunk at a time:
+		glm::ivec2 focus_chunk = glm::clamp(
+			glm::ivec2(glm::floor(glm::vec2(focus.x, focus.y) / float(Map::ChunkSize))),
+			glm::ivec2(0), glm::ivec2(int32_t(game.map.chunks_x), int32_t(game.map.chunks_y)) - glm::ivec2(1)
+		);
+		if (focus_chunk != map_focus_chunk) {
+			map_focus_chunk = focus_chunk;
+			rebuild_map_drawables();
+		}
+
+		size_t map_drawables = scene.drawables.size();
+
+		//this client's snake, as predicted:
+		if (have_snake) {
+			SnakeBody const &body = game.players.body[0];
+			for (size_t b = 0; b + 1 < body.size(); ++b) {
+				add_dynamic_drawable(glm::vec3(body[b]) + glm::vec3(0.0f, 0.0f, 1.0f), snakeCubePrefab);
+			}
+			add_dynamic_drawable(focus, snakeHeadPrefab);
+		}
+
+		//everyone else, interpolated a few ticks in the past:
+		remote.sample(&remote_views);
+		for (auto const &view : remote_views) {
+			if (view.body.empty()) continue;
+			for (size_t b = 0; b + 1 < view.body.size(); ++b) {
+				add_dynamic_drawable(view.body[b] + glm::vec3(0.0f, 0.0f, 1.0f), snakeCubePrefab);
+			}
+			add_dynamic_drawable(view.body.back() + glm::vec3(0.0f, 0.0f, 1.0f + view.zHeight), snakeHeadPrefab);
+		}
+
+		for (auto const &apple : game.apples) {
+			add_dynamic_drawable(glm::vec3(apple.position) + glm::vec3(0.0f, 0.0f, 1.0f), applePrefab);
+		}
+
+		//look down at the focus from behind and above:
+		glm::vec3 eye = focus + glm::vec3(0.0f, -8.0f, 12.0f);
+		glm::mat4 camera_to_world = glm::inverse(glm::lookAt(eye, focus, glm::vec3(0.0f, 0.0f, 1.0f)));
+		camera->transform->position = eye;
+		camera->transform->rotation = glm::quat_cast(glm::mat3(camera_to_world));
+
+		scene.draw(*camera);
+
+		auto first_dynamic = scene.drawables.begin();
+		std::advance(first_dynamic, map_drawables);
+		scene.drawables.erase(first_dynamic, scene.drawables.end());
+		dynamic_transforms.clear();
+	}
 
 	{ //use DrawLines to overlay some text:
 		glDisable(GL_DEPTH_TEST);
@@ -240,5 +351,13 @@ void PlayMode::draw(glm::uvec2 const &drawable_size) {
 			glm::vec3(-aspect + 0.1f * H + ofs, -1.0 + 0.1f * H + ofs, 0.0),
 			glm::vec3(H, 0.0f, 0.0f), glm::vec3(0.0f, H, 0.0f),
 			glm::u8vec4(0xff, 0xff, 0xff, 0x00));
+
+		//interpolation health (underruns mean states arrived too late for the delay; see --interp-delay):
+		std::string stats = "interp " + std::to_string(remote.delay_ticks).substr(0, 4) + " ticks, underruns: " + std::to_string(remote.underruns)
+			+ " (" + std::to_string(remote.underrun_frames) + "/" + std::to_string(remote.frames) + " frames), late: " + std::to_string(remote.late);
+		lines.draw_text(stats,
+			glm::vec3(-aspect + 0.1f * H, 1.0f - 1.1f * H, 0.0),
+			glm::vec3(0.5f * H, 0.0f, 0.0f), glm::vec3(0.0f, 0.5f * H, 0.0f),
+			glm::u8vec4(0xff, 0xff, 0xff, 0x00));
 	}
 }
@@ -2,11 +2,13 @@
 
 #include "Connection.hpp"
 #include "Game.hpp"
+#include "SnapshotBuffer.hpp"
 
 #include <glm/glm.hpp>
 
 #include <vector>
 #include <deque>
+#include <list>
 
 struct PlayMode : Mode {
 	PlayMode(Client &client);
@@ -21,10 +23,16 @@ struct PlayMode : Mode {
 
 	//input tracking for local player:
 	Player::Controls controls;
+	//controls are sampled (and move the local snake right away) once per Game::Tick:
+	float input_accumulator = 0.0f;
 
-	//latest game state (from server):
+	//latest game state (from server), with this client's snake predicted ahead from its own inputs:
 	Game game;
 
+	//recent states, for drawing other players slightly in the past (smoothly, whatever the network jitter):
+	SnapshotBuffer remote;
+	std::vector< SnapshotBuffer::PlayerView > remote_views; //(scratch space for draw)
+
 	//last message from server:
 	std::string server_message;
 
@@ -42,5 +50,15 @@ struct PlayMode : Mode {
 	Scene::Drawable::Pipeline barrierCornerPrefab;
 	Scene::Drawable::Pipeline applePrefab;
 
+	//map geometry, built from game.map for the chunks around the camera (big maps have far too many blocks to draw them all):
+	bool map_changed = false; //set when map messages arrive
+	glm::ivec2 map_focus_chunk = glm::ivec2(0); //chunk the camera was looking at when the geometry was built (see draw)
+	inline static constexpr int32_t MapDrawRadius = 1; //chunks drawn on each side of map_focus_chunk
+	size_t static_drawables = 0; //scene.drawables past this point draw map_transforms
+	std::list< Scene::Transform > map_transforms;
+	void rebuild_map_drawables();
 
+	//per-frame geometry (snakes, apples), added after the map in draw() and removed again after drawing:
+	std::list< Scene::Transform > dynamic_transforms;
+	void add_dynamic_drawable(glm::vec3 const &position, Scene::Drawable::Pipeline const &pipeline);
 };
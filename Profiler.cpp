@@ -0,0 +1,124 @@
+#include "Profiler.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <list>
+#include <mutex>
+#include <cassert>
+
+namespace Profiler {
+
+std::atomic< bool > enabled{false};
+
+namespace {
+	//named entries (lists, so references stay valid as entries are added):
+	struct Entries {
+		std::mutex mutex;
+		std::list< std::pair< std::string, Histogram > > histograms;
+		std::list< std::pair< std::string, std::atomic< uint64_t > > > counters;
+	};
+	Entries &get_entries() {
+		static Entries entries;
+		return entries;
+	}
+}
+
+uint32_t Histogram::bucket(uint64_t ns) {
+	if (ns < (uint64_t(1) << SubBits)) return uint32_t(ns);
+	//position of highest set bit:
+	uint32_t top = 63;
+	while (!(ns >> top)) --top;
+	uint32_t shift = top - SubBits;
+	//(top - SubBits + 1) selects the power-of-two range, the next SubBits bits below the top bit pick the sub-bucket:
+	return ((shift + 1) << SubBits) + uint32_t((ns >> shift) & ((1u << SubBits) - 1));
+}
+
+uint64_t Histogram::bucket_value(uint32_t bucket) {
+	if (bucket < (1u << SubBits)) return bucket;
+	uint32_t shift = (bucket >> SubBits) - 1;
+	uint64_t sub = bucket & ((1u << SubBits) - 1);
+	return (((uint64_t(1) << SubBits) + sub + 1) << shift) - 1;
+}
+
+void Histogram::record(uint64_t ns) {
+	counts[bucket(ns)].fetch_add(1, std::memory_order_relaxed);
+	total.fetch_add(1, std::memory_order_relaxed);
+	sum.fetch_add(ns, std::memory_order_relaxed);
+	uint64_t old = max.load(std::memory_order_relaxed);
+	while (ns > old && !max.compare_exchange_weak(old, ns, std::memory_order_relaxed)) { }
+}
+
+void Histogram::reset() {
+	for (auto &c : counts) c.store(0, std::memory_order_relaxed);
+	total.store(0, std::memory_order_relaxed);
+	sum.store(0, std::memory_order_relaxed);
+	max.store(0, std::memory_order_relaxed);
+}
+
+uint64_t Histogram::percentile(double p) const {
+	uint64_t n = total.load(std::memory_order_relaxed);
+	if (n == 0) return 0;
+	uint64_t want = uint64_t(p * double(n - 1)) + 1;
+	uint64_t seen = 0;
+	for (uint32_t b = 0; b < Buckets; ++b) {
+		seen += counts[b].load(std::memory_order_relaxed);
+		if (seen >= want) return std::min(bucket_value(b), max.load(std::memory_order_relaxed));
+	}
+	return max.load(std::memory_order_relaxed);
+}
+
+Histogram &histogram(char const *name) {
+	Entries &entries = get_entries();
+	std::unique_lock< std::mutex > lock(entries.mutex);
+	for (auto &entry : entries.histograms) {
+		if (entry.first == name) return entry.second;
+	}
+	entries.histograms.emplace_back(std::piecewise_construct, std::forward_as_tuple(name), std::forward_as_tuple());
+	return entries.histograms.back().second;
+}
+
+std::atomic< uint64_t > &counter(char const *name) {
+	Entries &entries = get_entries();
+	std::unique_lock< std::mutex > lock(entries.mutex);
+	for (auto &entry : entries.counters) {
+		if (entry.first == name) return entry.second;
+	}
+	entries.counters.emplace_back(std::piecewise_construct, std::forward_as_tuple(name), std::forward_as_tuple(0));
+	return entries.counters.back().second;
+}
+
+void dump(std::ostream &out, double interval) {
+	Entries &entries = get_entries();
+	std::unique_lock< std::mutex > lock(entries.mutex);
+
+	auto us = [](uint64_t ns) { return double(ns) * 1e-3; };
+
+	out << "=== profile (last " << std::fixed << std::setprecision(1) << interval << "s) ===\n";
+	out << std::left << std::setw(28) << "phase" << std::right
+	    << std::setw(10) << "count"
+	    << std::setw(10) << "mean"
+	    << std::setw(10) << "p50"
+	    << std::setw(10) << "p90"
+	    << std::setw(10) << "p99"
+	    << std::setw(10) << "max" << "  (us)\n";
+	for (auto &[name, h] : entries.histograms) {
+		uint64_t n = h.total.load(std::memory_order_relaxed);
+		out << std::left << std::setw(28) << name << std::right << std::setw(10) << n;
+		if (n) {
+			out << std::setprecision(1)
+			    << std::setw(10) << us(h.sum.load(std::memory_order_relaxed)) / n
+			    << std::setw(10) << us(h.percentile(0.5))
+			    << std::setw(10) << us(h.percentile(0.9))
+			    << std::setw(10) << us(h.percentile(0.99))
+			    << std::setw(10) << us(h.max.load(std::memory_order_relaxed));
+		}
+		out << "\n";
+		h.reset();
+	}
+	for (auto &[name, c] : entries.counters) {
+		out << std::left << std::setw(28) << name << std::right << std::setw(10) << c.exchange(0, std::memory_order_relaxed) << "\n";
+	}
+	out.flush();
+}
+
+} //namespace Profiler
@@ -0,0 +1,83 @@
+#pragma once
+
+/*
+ * Low-overhead timing of named phases, for finding where server time goes.
+ *
+ * void Game::update(float elapsed) {
+ *     PROFILE_SCOPE("game.update"); //time from here to end of scope
+ *     ...
+ *     PROFILE_COUNT("game.apples_eaten", eaten); //plain counters work too
+ * }
+ *
+ * Durations are recorded into log-linear ("HDR-style") histograms, so
+ * percentiles come out with ~3% relative error no matter the range.
+ * Each call site looks its histogram or counter up once, after which
+ * recording is a few relaxed atomic adds (a count is one), so both may be
+ * used from worker threads. Nothing is timed unless Profiler::enabled is set.
+ */
+
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
+#include <iosfwd>
+#include <string>
+
+namespace Profiler {
+
+//histogram of nanosecond durations:
+struct Histogram {
+	//values below 2^SubBits get exact buckets; above that each power of two is split into 2^SubBits buckets:
+	static constexpr uint32_t SubBits = 5;
+	static constexpr uint32_t Buckets = (64 - SubBits + 1) << SubBits;
+
+	std::array< std::atomic< uint64_t >, Buckets > counts{};
+	std::atomic< uint64_t > total{0};
+	std::atomic< uint64_t > sum{0};
+	std::atomic< uint64_t > max{0};
+
+	void record(uint64_t ns);
+	void reset();
+
+	static uint32_t bucket(uint64_t ns);
+	static uint64_t bucket_value(uint32_t bucket); //(upper end of bucket)
+	uint64_t percentile(double p) const;
+};
+
+//turn timing on/off (off by default):
+extern std::atomic< bool > enabled;
+
+//look up (or create) the histogram or counter with a given name (returned references stay valid):
+Histogram &histogram(char const *name);
+std::atomic< uint64_t > &counter(char const *name);
+
+//records time from construction to destruction:
+struct Scope {
+	Scope(Histogram &histogram_) : histogram(enabled.load(std::memory_order_relaxed) ? &histogram_ : nullptr) {
+		if (histogram) start = std::chrono::steady_clock::now();
+	}
+	~Scope() {
+		if (histogram) {
+			histogram->record(uint64_t(std::chrono::duration_cast< std::chrono::nanoseconds >(std::chrono::steady_clock::now() - start).count()));
+		}
+	}
+	Histogram *histogram;
+	std::chrono::steady_clock::time_point start;
+};
+
+//write a table of every histogram and counter, then reset them all:
+void dump(std::ostream &out, double interval);
+
+} //namespace Profiler
+
+#define PROFILE_CONCAT2(a, b) a ## b
+#define PROFILE_CONCAT(a, b) PROFILE_CONCAT2(a, b)
+//time the rest of the enclosing scope (histogram is looked up once per call site):
+#define PROFILE_SCOPE(name) \
+	static Profiler::Histogram &PROFILE_CONCAT(profile_histogram_, __LINE__) = Profiler::histogram(name); \
+	Profiler::Scope PROFILE_CONCAT(profile_scope_, __LINE__)(PROFILE_CONCAT(profile_histogram_, __LINE__))
+//add to a counter (looked up once per call site, so 'name' must be the same each time a site runs):
+#define PROFILE_COUNT(name, amount) do { \
+	static std::atomic< uint64_t > &profile_counter = Profiler::counter(name); \
+	if (Profiler::enabled.load(std::memory_order_relaxed)) profile_counter.fetch_add(uint64_t(amount), std::memory_order_relaxed); \
+} while (0)
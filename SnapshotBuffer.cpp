@@ -0,0 +1,103 @@
+#include "SnapshotBuffer.hpp"
+
+#include <algorithm>
+#include <cmath>
+#include <cassert>
+
+void SnapshotBuffer::push(Snapshot const &snapshot) {
+	if (!snapshots.empty() && snapshot.tick <= snapshots.back().tick) {
+		late += 1;
+		return;
+	}
+
+	snapshots.emplace_back(snapshot);
+	Snapshot &added = snapshots.back();
+	if (added.you < added.players.size()) {
+		added.players.erase(added.players.begin() + added.you);
+		added.you = ~0u;
+	}
+	while (snapshots.size() > Capacity) snapshots.pop_front();
+
+	//keep the clock near the newest tick: jump if far off (first state, long stall), otherwise
+	// nudge it, so that uneven arrival times average out instead of jerking the render time around:
+	double offset = double(snapshot.tick) - server_tick;
+	if (!synced || std::abs(offset) > 2.0 * Capacity) {
+		server_tick = double(snapshot.tick);
+		synced = true;
+	} else {
+		server_tick += 0.1 * offset;
+	}
+}
+
+void SnapshotBuffer::advance(float elapsed) {
+	if (synced) server_tick += double(elapsed) / double(Game::Tick);
+}
+
+void SnapshotBuffer::sample(std::vector< PlayerView > *views_) {
+	assert(views_);
+	auto &views = *views_;
+	views.clear();
+	if (snapshots.empty()) return;
+	frames += 1;
+
+	//find the states on either side of the render time:
+	double render_tick = server_tick - double(delay_ticks);
+	Snapshot const *a = &snapshots.front();
+	Snapshot const *b = nullptr;
+	float t = 0.0f;
+	bool underrun = (render_tick > double(snapshots.back().tick));
+	if (underrun) {
+		//(nothing newer to move towards; hold the newest state)
+		a = &snapshots.back();
+		underrun_frames += 1;
+		if (!in_underrun) underruns += 1;
+	} else if (render_tick > double(snapshots.front().tick)) {
+		for (size_t i = 0; i + 1 < snapshots.size(); ++i) {
+			if (render_tick <= double(snapshots[i+1].tick)) {
+				a = &snapshots[i];
+				b = &snapshots[i+1];
+				t = float((render_tick - double(a->tick)) / double(b->tick - a->tick));
+				break;
+			}
+		}
+	}
+	in_underrun = underrun;
+
+	//(snakes move at most a cell per tick, so anything further than that between the two states jumped)
+	float max_move = 1.5f * float(b ? b->tick - a->tick : 1);
+
+	views.reserve(a->players.size());
+	for (auto const &pa : a->players) {
+		Snapshot::PlayerState const *pb = nullptr;
+		if (b) {
+			for (auto const &candidate : b->players) {
+				if (candidate.handle == pa.handle) {
+					pb = &candidate;
+					break;
+				}
+			}
+		}
+
+		views.emplace_back();
+		PlayerView &view = views.back();
+		view.handle = pa.handle;
+		view.color = pa.color;
+		view.alive = pa.alive;
+		view.zHeight = (pb ? glm::mix(pa.zHeight, pb->zHeight, t) : pa.zHeight);
+
+		//blocks are matched counting back from the head, so a step slides every block one cell along;
+		// blocks with no counterpart (growth) or that jumped (respawn, wrapping) just take the newer position:
+		std::vector< glm::ivec3 > const &from = pa.body;
+		std::vector< glm::ivec3 > const &to = (pb ? pb->body : pa.body);
+		view.body.resize(to.size());
+		for (size_t j = 0; j < to.size(); ++j) {
+			glm::vec3 end = glm::vec3(to[to.size() - 1 - j]);
+			glm::vec3 result = end;
+			if (j < from.size()) {
+				glm::vec3 start = glm::vec3(from[from.size() - 1 - j]);
+				if (glm::dot(end - start, end - start) <= max_move * max_move) result = glm::mix(start, end, t);
+			}
+			view.body[to.size() - 1 - j] = result;
+		}
+	}
+}
@@ -0,0 +1,57 @@
+#pragma once
+
+/*
+ * SnapshotBuffer keeps the last few states received by a client and
+ * renders other players a little in the past, interpolating between the
+ * two states around that time, so network jitter doesn't show up as
+ * snakes jumping unevenly:
+ *
+ *   SnapshotBuffer remote;
+ *   remote.delay_ticks = 2.5f;
+ *   ...on each state: remote.push(game.received.back());
+ *   ...each frame:    remote.advance(elapsed); remote.sample(&views);
+ *
+ * The client's own player is left out (it is predicted instead; see Game::send_input).
+ */
+
+#include "Game.hpp"
+
+#include <glm/glm.hpp>
+
+#include <deque>
+#include <vector>
+#include <cstdint>
+
+struct SnapshotBuffer {
+	//how far behind the newest state to render, in ticks (2-3 hides a tick or two of jitter):
+	float delay_ticks = 2.5f;
+	//states kept (older ones are dropped):
+	inline static constexpr size_t Capacity = 16;
+
+	//remember a received state (states older than the newest one are ignored):
+	void push(Snapshot const &snapshot);
+	//advance the render clock by one frame:
+	void advance(float elapsed);
+
+	//other players as of the render time:
+	struct PlayerView {
+		Player::Handle handle;
+		glm::vec3 color = glm::vec3(1.0f);
+		float zHeight = 0.0f;
+		uint8_t alive = 1;
+		std::vector< glm::vec3 > body; //tail-to-head
+	};
+	void sample(std::vector< PlayerView > *views);
+
+	//stats:
+	uint64_t frames = 0; //calls to sample()
+	uint64_t underrun_frames = 0; //frames rendered past the newest state (it hadn't arrived in time)
+	uint64_t underruns = 0; //times the buffer ran dry (runs of underrun frames)
+	uint64_t late = 0; //states that arrived after a newer one (ignored)
+
+	//internals:
+	std::deque< Snapshot > snapshots; //oldest first, without the client's own player
+	double server_tick = 0.0; //estimate of the server's current tick (fractional)
+	bool synced = false; //has server_tick been set from a state yet?
+	bool in_underrun = false;
+};
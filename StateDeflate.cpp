@@ -0,0 +1,76 @@
+#include "StateDeflate.hpp"
+
+#include <zlib.h>
+
+#include <algorithm>
+#include <stdexcept>
+#include <string>
+#include <cstring>
+#include <cassert>
+
+//n.b. raw deflate (negative window bits): both ends already know what the stream is, so no zlib header or checksum.
+
+DeflateStream::DeflateStream() : stream(new z_stream) {
+	std::memset(stream.get(), 0, sizeof(z_stream));
+	if (deflateInit2(stream.get(), Level, Z_DEFLATED, -WindowBits, MemLevel, Z_DEFAULT_STRATEGY) != Z_OK) {
+		throw std::runtime_error("Failed to set up deflate stream.");
+	}
+}
+
+DeflateStream::~DeflateStream() {
+	deflateEnd(stream.get());
+}
+
+void DeflateStream::compress(void const *data, size_t size, bool flush, std::vector< uint8_t > *out) {
+	assert(out);
+	size_t start = out->size();
+	stream->next_in = reinterpret_cast< Bytef * >(const_cast< void * >(data));
+	stream->avail_in = uInt(size);
+	while (true) {
+		size_t at = out->size();
+		out->resize(at + std::max< size_t >(256, size / 2));
+		stream->next_out = out->data() + at;
+		stream->avail_out = uInt(out->size() - at);
+		int ret = deflate(stream.get(), flush ? Z_SYNC_FLUSH : Z_NO_FLUSH);
+		out->resize(out->size() - stream->avail_out);
+		if (ret == Z_STREAM_ERROR) throw std::runtime_error("Deflate stream error.");
+		//(room left over means deflate had nothing more to write)
+		if (stream->avail_in == 0 && stream->avail_out != 0) break;
+	}
+	bytes_in += size;
+	bytes_out += out->size() - start;
+}
+
+InflateStream::InflateStream() : stream(new z_stream) {
+	std::memset(stream.get(), 0, sizeof(z_stream));
+	if (inflateInit2(stream.get(), -DeflateStream::WindowBits) != Z_OK) {
+		throw std::runtime_error("Failed to set up inflate stream.");
+	}
+}
+
+InflateStream::~InflateStream() {
+	inflateEnd(stream.get());
+}
+
+void InflateStream::decompress(void const *data, size_t size, std::vector< uint8_t > *out) {
+	assert(out);
+	size_t start = out->size();
+	stream->next_in = reinterpret_cast< Bytef * >(const_cast< void * >(data));
+	stream->avail_in = uInt(size);
+	while (true) {
+		size_t at = out->size();
+		if (at - start > MaxExpanded) throw std::runtime_error("Compressed data expands too far.");
+		out->resize(at + std::max< size_t >(1024, size * 4));
+		stream->next_out = out->data() + at;
+		stream->avail_out = uInt(out->size() - at);
+		int ret = inflate(stream.get(), Z_SYNC_FLUSH);
+		out->resize(out->size() - stream->avail_out);
+		//(the sender never ends its stream, so Z_STREAM_END is an error too)
+		if (ret != Z_OK && ret != Z_BUF_ERROR) {
+			throw std::runtime_error("Corrupt compressed data (" + std::string(stream->msg ? stream->msg : "inflate error " + std::to_string(ret)) + ").");
+		}
+		if (stream->avail_in == 0 && stream->avail_out != 0) break;
+	}
+	bytes_in += size;
+	bytes_out += out->size() - start;
+}
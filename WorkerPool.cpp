@@ -0,0 +1,81 @@
+#include "WorkerPool.hpp"
+
+#include <algorithm>
+#include <cassert>
+
+WorkerPool::WorkerPool(uint32_t count) {
+	threads.reserve(count);
+	for (uint32_t t = 0; t < count; ++t) {
+		threads.emplace_back([this](){
+			std::unique_lock< std::mutex > lock(mutex);
+			while (true) {
+				wake.wait(lock, [this](){ return quit || !jobs.empty(); });
+				if (quit) break;
+
+				Job &job = *jobs.front();
+				job.users += 1;
+				lock.unlock();
+
+				work_on(job);
+
+				lock.lock();
+				//every batch is claimed, so nobody else needs to find this job:
+				auto f = std::find(jobs.begin(), jobs.end(), &job);
+				if (f != jobs.end()) jobs.erase(f);
+				job.users -= 1;
+				finished.notify_all();
+			}
+		});
+	}
+}
+
+WorkerPool::~WorkerPool() {
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		quit = true;
+	}
+	wake.notify_all();
+	for (auto &thread : threads) {
+		thread.join();
+	}
+}
+
+void WorkerPool::work_on(Job &job) {
+	while (true) {
+		uint32_t begin = job.next.fetch_add(job.batch);
+		if (begin >= job.count) break;
+		uint32_t end = std::min(job.count, begin + job.batch);
+		(*job.fn)(begin, end);
+		job.done.fetch_add(end - begin);
+	}
+}
+
+void WorkerPool::parallel_for(uint32_t count, std::function< void(uint32_t begin, uint32_t end) > const &fn, uint32_t batch) {
+	assert(batch > 0);
+	if (count == 0) return;
+
+	//not worth waking anyone for a single batch:
+	if (threads.empty() || count <= batch) {
+		fn(0, count);
+		return;
+	}
+
+	Job job;
+	job.fn = &fn;
+	job.count = count;
+	job.batch = batch;
+
+	{
+		std::unique_lock< std::mutex > lock(mutex);
+		jobs.emplace_back(&job);
+	}
+	wake.notify_all();
+
+	work_on(job);
+
+	//wait for batches claimed by workers to finish and for workers to let go of the job:
+	std::unique_lock< std::mutex > lock(mutex);
+	auto f = std::find(jobs.begin(), jobs.end(), &job);
+	if (f != jobs.end()) jobs.erase(f);
+	finished.wait(lock, [&job](){ return job.done.load() == job.count && job.users == 0; });
+}
@@ -0,0 +1,53 @@
+#pragma once
+
+/*
+ * WorkerPool runs batches of a loop body on a set of worker threads:
+ *
+ * WorkerPool workers(3); //three helper threads (plus the calling thread)
+ * workers.parallel_for(count, [&](uint32_t begin, uint32_t end){
+ *     for (uint32_t i = begin; i < end; ++i) ...
+ * });
+ *
+ * The calling thread always works on its own loop too, so parallel_for
+ * may be called from inside a task running on the same pool without
+ * deadlocking (at worst, the caller runs every batch itself).
+ */
+
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <condition_variable>
+#include <thread>
+#include <vector>
+#include <deque>
+#include <atomic>
+
+struct WorkerPool {
+	//threads == 0 means everything runs on the calling thread:
+	WorkerPool(uint32_t threads);
+	~WorkerPool();
+
+	//calls fn(begin, end) over batches of [0,count), returning once all batches are done:
+	void parallel_for(uint32_t count, std::function< void(uint32_t begin, uint32_t end) > const &fn, uint32_t batch = 64);
+
+	uint32_t size() const { return uint32_t(threads.size()); }
+
+	//internals:
+	struct Job {
+		std::function< void(uint32_t, uint32_t) > const *fn = nullptr;
+		uint32_t count = 0;
+		uint32_t batch = 1;
+		std::atomic< uint32_t > next{0}; //first index not yet claimed
+		std::atomic< uint32_t > done{0}; //number of indices finished
+		uint32_t users = 0; //workers currently holding a pointer to this job (guarded by mutex)
+	};
+	//claim and run batches of 'job' until none are left:
+	static void work_on(Job &job);
+
+	std::mutex mutex;
+	std::condition_variable wake; //signalled when jobs are added (or on quit)
+	std::condition_variable finished; //signalled when a job might be finished
+	std::deque< Job * > jobs; //jobs with unclaimed batches
+	bool quit = false;
+	std::vector< std::thread > threads;
+};
@@ -0,0 +1,85 @@
+#include "BodyCodec.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <string>
+#include <cstdint>
+
+//benchmark for BodyCodec: encode and decode speed on snake-like bodies, and how many bytes each block takes:
+//   ./bodycodec-bench [body length] [bodies]
+// (MB/s are of raw block data, i.e., 12 bytes per glm::ivec3, as bodies were sent before)
+
+int main(int argc, char **argv) {
+	size_t length = (argc >= 2 ? size_t(std::stoul(argv[1])) : 200);
+	size_t bodies = (argc >= 3 ? size_t(std::stoul(argv[2])) : 1000);
+	if (argc > 3 || length == 0 || bodies == 0) {
+		std::cerr << "Usage:\n\t./bodycodec-bench [body length] [bodies]" << std::endl;
+		return 1;
+	}
+
+	//random walks: single grid steps, with a jump (z change) now and then:
+	std::mt19937 mt(0xb0d1e5);
+	std::vector< std::vector< glm::ivec3 > > walks(bodies);
+	for (auto &walk : walks) {
+		glm::ivec3 at(int(mt() % 256), int(mt() % 256), 0);
+		walk.reserve(length);
+		for (size_t i = 0; i < length; ++i) {
+			glm::ivec3 const steps[4] = { glm::ivec3(-1,0,0), glm::ivec3(1,0,0), glm::ivec3(0,1,0), glm::ivec3(0,-1,0) };
+			at += steps[mt() % 4];
+			if (mt() % 20 == 0) at.z = (at.z == 0 ? 1 : 0);
+			walk.emplace_back(at);
+		}
+	}
+	double raw_bytes = double(bodies) * double(length) * sizeof(glm::ivec3);
+
+	//encode (repeated until enough time has passed to measure):
+	std::vector< std::vector< uint8_t > > encoded(bodies);
+	uint32_t encode_passes = 0;
+	auto before = std::chrono::steady_clock::now();
+	double encode_seconds = 0.0;
+	do {
+		for (size_t b = 0; b < bodies; ++b) {
+			encoded[b].clear();
+			BodyCodec::write_steps(encoded[b], glm::ivec3(0), walks[b].data(), walks[b].size());
+		}
+		encode_passes += 1;
+		encode_seconds = std::chrono::duration< double >(std::chrono::steady_clock::now() - before).count();
+	} while (encode_seconds < 0.5);
+
+	size_t encoded_bytes = 0;
+	for (auto const &bytes : encoded) encoded_bytes += bytes.size();
+
+	//decode:
+	std::vector< glm::ivec3 > read;
+	read.reserve(length);
+	uint32_t decode_passes = 0;
+	size_t mismatches = 0;
+	before = std::chrono::steady_clock::now();
+	double decode_seconds = 0.0;
+	do {
+		for (size_t b = 0; b < bodies; ++b) {
+			read.clear();
+			BodyCodec::read_steps(encoded[b].data(), encoded[b].size(), glm::ivec3(0), length, &read);
+			if (decode_passes == 0 && read != walks[b]) mismatches += 1;
+		}
+		decode_passes += 1;
+		decode_seconds = std::chrono::duration< double >(std::chrono::steady_clock::now() - before).count();
+	} while (decode_seconds < 0.5);
+
+	if (mismatches) {
+		std::cerr << mismatches << " bodies didn't read back the same!" << std::endl;
+		return 1;
+	}
+
+	std::cout << std::fixed << std::setprecision(3)
+	          << bodies << " bodies of " << length << " blocks:\n"
+	          << "  size    " << double(encoded_bytes) / (double(bodies) * double(length)) << " bytes per block ("
+	          << sizeof(glm::ivec3) << " raw), " << double(encoded_bytes) / double(bodies) << " bytes per body\n"
+	          << std::setprecision(1)
+	          << "  encode  " << (raw_bytes * encode_passes / encode_seconds) / 1e6 << " MB/s\n"
+	          << "  decode  " << (raw_bytes * decode_passes / decode_seconds) / 1e6 << " MB/s" << std::endl;
+	return 0;
+}
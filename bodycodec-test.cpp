@@ -0,0 +1,153 @@
+#include "BodyCodec.hpp"
+
+#include <iostream>
+#include <random>
+#include <vector>
+#include <string>
+#include <stdexcept>
+#include <cstdint>
+
+//round-trip test for BodyCodec: bodies written with write_steps must read back exactly with read_steps,
+// and truncated or corrupted data must throw rather than read out of bounds:
+//   ./bodycodec-test [seed]
+
+static uint32_t failures = 0;
+
+static void check(bool ok, std::string const &what) {
+	if (ok) return;
+	std::cerr << "FAILED: " << what << std::endl;
+	failures += 1;
+}
+
+static std::string str(glm::ivec3 const &v) {
+	return "(" + std::to_string(v.x) + ", " + std::to_string(v.y) + ", " + std::to_string(v.z) + ")";
+}
+
+//a snake-like body: mostly single grid steps, with z changes (jumps), stays, and wraps across a map edge:
+static std::vector< glm::ivec3 > random_walk(std::mt19937 &mt, glm::ivec3 start, size_t count, int width, int height) {
+	std::vector< glm::ivec3 > body;
+	body.reserve(count);
+	glm::ivec3 at = start;
+	for (size_t i = 0; i < count; ++i) {
+		uint32_t r = mt() % 100;
+		if (r < 80) {
+			glm::ivec3 const steps[4] = { glm::ivec3(-1,0,0), glm::ivec3(1,0,0), glm::ivec3(0,1,0), glm::ivec3(0,-1,0) };
+			at += steps[mt() % 4];
+		} else if (r < 88) {
+			at.z += int(mt() % 5) - 2; //(jump up or land, maybe with a step too)
+			if (mt() % 2) at.x += (mt() % 2 ? 1 : -1);
+		} else if (r < 93) {
+			//stay in place (e.g., a growing tail)
+		} else {
+			//off an edge, back in on the other side:
+			at.x = (at.x <= 0 ? width - 1 : 0);
+			at.y = int(mt() % uint32_t(height));
+		}
+		body.emplace_back(at);
+	}
+	return body;
+}
+
+//write 'body' from 'from', read it back, and compare; also check that every truncation throws:
+static void round_trip(std::vector< glm::ivec3 > const &body, glm::ivec3 from, std::string const &name) {
+	std::vector< uint8_t > bytes;
+	BodyCodec::write_steps(bytes, from, body.data(), body.size());
+
+	std::vector< glm::ivec3 > read;
+	size_t used = 0;
+	try {
+		used = BodyCodec::read_steps(bytes.data(), bytes.size(), from, body.size(), &read);
+	} catch (std::exception const &e) {
+		check(false, name + ": read threw '" + e.what() + "'");
+		return;
+	}
+	check(used == bytes.size(), name + ": read " + std::to_string(used) + " of " + std::to_string(bytes.size()) + " bytes");
+	check(read.size() == body.size(), name + ": read " + std::to_string(read.size()) + " of " + std::to_string(body.size()) + " blocks");
+	for (size_t i = 0; i < body.size() && i < read.size(); ++i) {
+		if (read[i] != body[i]) {
+			check(false, name + ": block " + std::to_string(i) + " read as " + str(read[i]) + ", was " + str(body[i]));
+			break;
+		}
+	}
+
+	for (size_t size = 0; size < bytes.size(); ++size) {
+		std::vector< uint8_t > truncated(bytes.begin(), bytes.begin() + size); //(own allocation, so overreads show up under a sanitizer)
+		std::vector< glm::ivec3 > ignored;
+		bool threw = false;
+		try {
+			BodyCodec::read_steps(truncated.data(), truncated.size(), from, body.size(), &ignored);
+		} catch (std::runtime_error const &) {
+			threw = true;
+		}
+		if (!threw) {
+			check(false, name + ": truncated to " + std::to_string(size) + " of " + std::to_string(bytes.size()) + " bytes, but didn't throw");
+			break;
+		}
+	}
+}
+
+int main(int argc, char **argv) {
+	uint32_t seed = (argc >= 2 ? uint32_t(std::stoul(argv[1])) : 1);
+	std::mt19937 mt(seed);
+
+	//edge cases:
+	round_trip({}, glm::ivec3(0), "empty body");
+	round_trip({}, glm::ivec3(17, -3, 2), "empty body, from elsewhere");
+	round_trip({ glm::ivec3(0) }, glm::ivec3(0), "one block at the origin");
+	round_trip({ glm::ivec3(4095, 4095, 0) }, glm::ivec3(0), "one block at the far corner");
+	round_trip({ glm::ivec3(-1000000, 1000000, -7) }, glm::ivec3(0), "one block far away");
+	round_trip({ glm::ivec3(5, 5, 1) }, glm::ivec3(5, 5, 0), "one block, z change only");
+	round_trip({ glm::ivec3(3, 3, 0), glm::ivec3(3, 3, 0), glm::ivec3(3, 3, 0) }, glm::ivec3(3, 3, 0), "blocks that stay put");
+	round_trip({ glm::ivec3(63, 10, 0), glm::ivec3(0, 10, 0), glm::ivec3(1, 10, 0) }, glm::ivec3(62, 10, 0), "wrap across the x edge");
+
+	//random walks, whole (from the origin) and as deltas (from a block the reader already has):
+	for (uint32_t i = 0; i < 2000; ++i) {
+		size_t count = (i % 10 == 0 ? mt() % 4 : mt() % 300);
+		glm::ivec3 start(int(mt() % 64), int(mt() % 64), int(mt() % 3));
+		std::vector< glm::ivec3 > body = random_walk(mt, start, count, 64, 64);
+		round_trip(body, glm::ivec3(0), "walk " + std::to_string(i) + " (whole)");
+		round_trip(body, start, "walk " + std::to_string(i) + " (delta)");
+	}
+
+	//several runs back to back in one buffer (as in a state message), each continuing from the last:
+	{
+		std::vector< std::vector< glm::ivec3 > > runs;
+		std::vector< uint8_t > bytes;
+		glm::ivec3 from(0);
+		for (uint32_t r = 0; r < 50; ++r) {
+			runs.emplace_back(random_walk(mt, from, mt() % 20, 64, 64));
+			BodyCodec::write_steps(bytes, from, runs.back().data(), runs.back().size());
+			if (!runs.back().empty()) from = runs.back().back();
+		}
+		size_t at = 0;
+		from = glm::ivec3(0);
+		for (uint32_t r = 0; r < runs.size(); ++r) {
+			std::vector< glm::ivec3 > read;
+			at += BodyCodec::read_steps(bytes.data() + at, bytes.size() - at, from, runs[r].size(), &read);
+			check(read == runs[r], "back-to-back run " + std::to_string(r));
+			if (!read.empty()) from = read.back();
+		}
+		check(at == bytes.size(), "back-to-back runs: read " + std::to_string(at) + " of " + std::to_string(bytes.size()) + " bytes");
+	}
+
+	//corrupted data may decode to something else, but must either do that or throw:
+	for (uint32_t i = 0; i < 2000; ++i) {
+		std::vector< glm::ivec3 > body = random_walk(mt, glm::ivec3(10, 10, 0), 1 + mt() % 50, 64, 64);
+		std::vector< uint8_t > bytes;
+		BodyCodec::write_steps(bytes, glm::ivec3(0), body.data(), body.size());
+		bytes[mt() % bytes.size()] ^= uint8_t(1 + mt() % 255);
+		std::vector< glm::ivec3 > read;
+		try {
+			size_t used = BodyCodec::read_steps(bytes.data(), bytes.size(), glm::ivec3(0), body.size(), &read);
+			check(used <= bytes.size(), "corrupted data: read past the end");
+		} catch (std::runtime_error const &) {
+		}
+	}
+
+	if (failures) {
+		std::cerr << failures << " failure(s) (seed " << seed << ")." << std::endl;
+		return 1;
+	}
+	std::cout << "BodyCodec round trips passed (seed " << seed << ")." << std::endl;
+	return 0;
+}
@@ -0,0 +1,84 @@
+#include "ByteQueue.hpp"
+
+#include <chrono>
+#include <iostream>
+#include <iomanip>
+#include <vector>
+#include <string>
+#include <cstdint>
+#include <cstring>
+
+//benchmark: parse a backlog of queued controls-sized messages, consuming each one from the front of the
+// buffer, with vector::erase (as recv_buffer used to) and with ByteQueue::consume:
+//   ./bytequeue-bench [messages]
+
+//[type][size:3][client tick:4][count:1][one input:6] (the size of a single-input C2S_Controls message):
+static const size_t Payload = 4 + 1 + 6;
+
+static void append_messages(size_t count, std::vector< uint8_t > *out) {
+	for (size_t i = 0; i < count; ++i) {
+		uint8_t message[4 + Payload];
+		std::memset(message, 0, sizeof(message));
+		message[0] = 1;
+		message[1] = uint8_t(Payload);
+		uint32_t tick = uint32_t(i);
+		std::memcpy(message + 4, &tick, 4);
+		message[8] = 1;
+		out->insert(out->end(), message, message + sizeof(message));
+	}
+}
+
+//read one message from the front of 'buffer' (if there is a whole one), adding its tick to *sum:
+template< typename Buffer, typename Consume >
+static bool parse(Buffer &buffer, uint64_t *sum, Consume const &consume) {
+	if (buffer.size() < 4) return false;
+	uint32_t size = (uint32_t(buffer[3]) << 16) | (uint32_t(buffer[2]) << 8) | uint32_t(buffer[1]);
+	if (buffer.size() < 4 + size) return false;
+	uint32_t tick;
+	std::memcpy(&tick, &buffer[4], 4);
+	*sum += tick;
+	consume(4 + size);
+	return true;
+}
+
+int main(int argc, char **argv) {
+	std::vector< size_t > counts;
+	if (argc == 2) counts.emplace_back(size_t(std::stoul(argv[1])));
+	else if (argc == 1) counts = { 1000, 10000, 100000 };
+	else {
+		std::cerr << "Usage:\n\t./bytequeue-bench [messages]" << std::endl;
+		return 1;
+	}
+
+	std::cout << "parsing N queued " << (4 + Payload) << "-byte messages from the front of a buffer:\n";
+	for (size_t count : counts) {
+		std::vector< uint8_t > bytes;
+		append_messages(count, &bytes);
+
+		uint64_t erase_sum = 0;
+		auto before = std::chrono::steady_clock::now();
+		{
+			std::vector< uint8_t > buffer = bytes;
+			while (parse(buffer, &erase_sum, [&](size_t n){ buffer.erase(buffer.begin(), buffer.begin() + n); })) { }
+		}
+		double erase_ms = std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - before).count();
+
+		uint64_t consume_sum = 0;
+		before = std::chrono::steady_clock::now();
+		{
+			ByteQueue buffer;
+			buffer.append(bytes.data(), bytes.size());
+			while (parse(buffer, &consume_sum, [&](size_t n){ buffer.consume(n); })) { }
+		}
+		double consume_ms = std::chrono::duration< double, std::milli >(std::chrono::steady_clock::now() - before).count();
+
+		if (erase_sum != consume_sum) {
+			std::cerr << "Parsed different messages (" << erase_sum << " vs " << consume_sum << ")!" << std::endl;
+			return 1;
+		}
+		std::cout << std::fixed << std::setprecision(3)
+		          << "  " << std::setw(7) << count << " messages: vector::erase " << std::setw(10) << erase_ms << " ms"
+		          << ", ByteQueue::consume " << std::setw(8) << consume_ms << " ms\n";
+	}
+	return 0;
+}
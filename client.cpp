@@ -34,13 +34,26 @@ int main(int argc, char **argv) {
 	try {
 #endif
 	//------------ command line arguments ------------
-	if (argc != 3) {
-		std::cerr << "Usage:\n\t./client <host> <port>" << std::endl;
-		return 1;
+	Transport transport = Transport::TCP;
+	float interp_delay = 2.5f; //ticks other players are drawn behind the newest state
+	bool deflate = false; //ask the server to compress states
+	{
+		bool ok = (argc >= 3);
+		for (int argi = 3; ok && argi < argc; ++argi) {
+			std::string arg = argv[argi];
+			if (arg == "--udp") transport = Transport::UDP;
+			else if (arg == "--interp-delay" && argi + 1 < argc) interp_delay = std::stof(argv[++argi]);
+			else if (arg == "--deflate") deflate = true;
+			else ok = false;
+		}
+		if (!ok || !(interp_delay >= 0.0f)) {
+			std::cerr << "Usage:\n\t./client <host> <port> [--udp] [--interp-delay ticks] [--deflate]" << std::endl;
+			return 1;
+		}
 	}
 
 	//------------ connect to server --------------
-	Client client(argv[1], argv[2]);
+	Client client(argv[1], argv[2], transport);
 
 	//------------  initialization ------------
 
@@ -112,7 +125,12 @@ int main(int argc, char **argv) {
 	call_load_functions();
 
 	//------------ create game mode + make current --------------
-	Mode::set_current(std::make_shared< PlayMode >(client));
+	{
+		auto play = std::make_shared< PlayMode >(client);
+		play->remote.delay_ticks = interp_delay;
+		if (deflate && transport == Transport::TCP) play->game.send_deflate_request_message(&client.connection);
+		Mode::set_current(play);
+	}
 
 	//------------ main loop ------------
 
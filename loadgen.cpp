@@ -0,0 +1,233 @@
+#include "Connection.hpp"
+
+#include "Game.hpp"
+
+#include <chrono>
+#include <stdexcept>
+#include <iostream>
+#include <iomanip>
+#include <cassert>
+#include <memory>
+#include <random>
+#include <thread>
+#include <algorithm>
+#include <vector>
+
+//headless bot clients, used to put load on a server and measure how it holds up:
+
+//one simulated player:
+struct Bot {
+	Bot(std::string const &host, std::string const &port, Transport transport) : client(host, port, transport) { }
+	Client client;
+	Game game; //latest state from server (only used for parsing)
+	Player::Controls controls;
+
+	size_t unparsed = 0; //bytes already in recv_buffer at last parse (to count new bytes)
+	bool have_state = false;
+	std::chrono::steady_clock::time_point last_state;
+
+	//direction change waiting to show up in a state message:
+	bool waiting = false;
+	Direction wanted = right;
+	std::chrono::steady_clock::time_point pressed_at;
+	std::chrono::steady_clock::time_point next_change;
+};
+
+//simple sample collection with percentile reporting:
+struct Samples {
+	std::vector< double > values;
+	void add(double v) { values.emplace_back(v); }
+	void report(std::ostream &out, std::string const &name, std::string const &unit, double scale) {
+		out << "  " << std::setw(14) << std::left << name << std::right;
+		if (values.empty()) {
+			out << " (no samples)\n";
+			return;
+		}
+		std::sort(values.begin(), values.end());
+		auto pct = [&](double p) {
+			size_t i = std::min(values.size() - 1, size_t(p * double(values.size() - 1) + 0.5));
+			return values[i] * scale;
+		};
+		double sum = 0.0;
+		for (double v : values) sum += v;
+		out << std::fixed << std::setprecision(2)
+		    << " n=" << values.size()
+		    << " mean=" << (sum / values.size()) * scale << unit
+		    << " p50=" << pct(0.5) << unit
+		    << " p90=" << pct(0.9) << unit
+		    << " p99=" << pct(0.99) << unit
+		    << " max=" << values.back() * scale << unit << "\n";
+		values.clear();
+	}
+};
+
+int main(int argc, char **argv) {
+	//------------ argument parsing ------------
+	Transport transport = Transport::TCP;
+	double drop_rate = 0.0; //fraction of outgoing udp datagrams to drop (for testing)
+	bool deflate = false; //ask for compressed states
+	std::vector< std::string > args;
+	for (int argi = 1; argi < argc; ++argi) {
+		std::string arg = argv[argi];
+		if (arg == "--udp") transport = Transport::UDP;
+		else if (arg == "--drop" && argi + 1 < argc) drop_rate = std::stod(argv[++argi]);
+		else if (arg == "--deflate") deflate = true;
+		else args.emplace_back(arg);
+	}
+	if (args.size() < 3 || args.size() > 5) {
+		std::cerr << "Usage:\n\t./loadgen <host> <port> <clients> [seconds] [report-interval] [--udp [--drop fraction]] [--deflate]" << std::endl;
+		return 1;
+	}
+	std::string host = args[0];
+	std::string port = args[1];
+	uint32_t count = uint32_t(std::stoul(args[2]));
+	double duration = (args.size() >= 4 ? std::stod(args[3]) : 30.0);
+	double report_interval = (args.size() >= 5 ? std::stod(args[4]) : 5.0);
+
+	//------------ connect ------------
+	std::mt19937 mt(0x10adbeef);
+	std::vector< std::unique_ptr< Bot > > bots;
+	bots.reserve(count);
+	for (uint32_t i = 0; i < count; ++i) {
+		bots.emplace_back(std::make_unique< Bot >(host, port, transport));
+		bots.back()->client.poller.drop_rate = drop_rate;
+		bots.back()->client.poller.drop_rng.seed(i);
+		if (deflate && transport == Transport::TCP) bots.back()->game.send_deflate_request_message(&bots.back()->client.connection);
+	}
+	std::cout << "Connected " << bots.size() << " clients." << std::endl;
+
+	//------------ main loop ------------
+	Samples jitter; //|time between state messages - Game::Tick|
+	Samples latency; //direction change sent -> seen in state
+	size_t bytes = 0; //received since last report
+	size_t states = 0; //state messages since last report
+	uint64_t controls_reported = 0; //controls messages sent by all bots, as of last report
+	uint64_t inflated_in_reported = 0, inflated_out_reported = 0; //compressed bytes expanded by all bots (and what they expanded to), as of last report
+	size_t closed = 0;
+	size_t changes_lost = 0; //direction changes not seen in a state within ChangeTimeout (since last report)
+	const auto ChangeTimeout = std::chrono::seconds(2); //(e.g., the snake died or respawned before turning)
+
+	auto start = std::chrono::steady_clock::now();
+	auto last_report = start;
+	auto next_send = start;
+	for (auto &bot : bots) {
+		bot->next_change = start + std::chrono::milliseconds(500 + mt() % 1500);
+	}
+
+	while (true) {
+		auto now = std::chrono::steady_clock::now();
+		if (std::chrono::duration< double >(now - start).count() > duration) break;
+
+		//change direction now and then, always turning (so the move is never refused as a reversal):
+		bool send = (now >= next_send);
+		if (send) next_send += std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(Game::Tick));
+
+		for (auto &bot : bots) {
+			if (!bot->client.connection) continue;
+
+			//give up on a change that never showed up, so the bot keeps turning (and measuring):
+			if (bot->waiting && now - bot->pressed_at > ChangeTimeout) {
+				changes_lost += 1;
+				bot->waiting = false;
+			}
+
+			if (bot->have_state && !bot->waiting && now >= bot->next_change) {
+				Direction current = bot->game.players.move_dir[0];
+				bool horizontal = (current == left || current == right);
+				bot->wanted = (horizontal ? (mt() % 2 ? up : down) : (mt() % 2 ? left : right));
+				bot->controls.left.pressed = (bot->wanted == left);
+				bot->controls.right.pressed = (bot->wanted == right);
+				bot->controls.up.pressed = (bot->wanted == up);
+				bot->controls.down.pressed = (bot->wanted == down);
+				bot->controls.jump.pressed = (mt() % 8 == 0);
+				bot->waiting = true;
+				bot->pressed_at = now;
+				bot->next_change = now + std::chrono::milliseconds(500 + mt() % 1500);
+			}
+
+			//controls are sampled at the server's tick rate (and only sent when they change; see Game::send_input):
+			// (so a change goes out with the bot's next sample -- sending it right away would also advance the
+			//  bot's tick, running its clock ahead of the server's)
+			if (send) {
+				bot->game.send_input(&bot->client.connection, bot->controls);
+			}
+
+			bot->client.poll([&](Connection *c, Connection::Event event){
+				if (event == Connection::OnClose) {
+					closed += 1;
+				} else if (event == Connection::OnRecv) {
+					bytes += c->recv_buffer.size() - bot->unparsed;
+					auto at = std::chrono::steady_clock::now();
+					bool handled_message;
+					do {
+						handled_message = false;
+						if (bot->game.recv_map_message(c)) handled_message = true;
+						if (bot->game.recv_state_message(c)) {
+							handled_message = true;
+							states += 1;
+							if (bot->have_state) {
+								jitter.add(std::abs(std::chrono::duration< double >(at - bot->last_state).count() - Game::Tick));
+							}
+							bot->have_state = true;
+							bot->last_state = at;
+							//(measured on the state as sent, not on the predicted player)
+							Snapshot const &state = bot->game.received.back();
+							if (bot->waiting && state.you < state.players.size() && state.players[state.you].move_dir == bot->wanted) {
+								latency.add(std::chrono::duration< double >(at - bot->pressed_at).count());
+								bot->waiting = false;
+							}
+						}
+					} while (handled_message);
+					bot->unparsed = c->recv_buffer.size();
+				}
+			}, 0.0);
+		}
+
+		if (std::chrono::duration< double >(now - last_report).count() >= report_interval) {
+			double elapsed = std::chrono::duration< double >(now - last_report).count();
+			std::cout << "--- " << std::fixed << std::setprecision(1) << std::chrono::duration< double >(now - start).count() << "s ---\n";
+			std::cout << "  received      " << std::setprecision(1) << (bytes / elapsed) / 1024.0 << " KiB/s, "
+			          << (states / elapsed) << " states/s, " << closed << " disconnected\n";
+			uint64_t controls_sent = 0;
+			for (auto &bot : bots) {
+				controls_sent += bot->game.controls_messages_sent;
+			}
+			std::cout << "  sent          " << std::setprecision(1) << ((controls_sent - controls_reported) / elapsed) << " controls messages/s\n";
+			controls_reported = controls_sent;
+			if (transport == Transport::UDP) {
+				uint64_t lost = 0, superseded = 0;
+				for (auto &bot : bots) {
+					if (!bot->client.connection.udp) continue;
+					lost += bot->client.connection.udp->droppable_lost;
+					superseded += bot->client.connection.udp->droppable_superseded;
+				}
+				std::cout << "  udp           " << lost << " states lost in total (" << superseded << " superseded before sending)\n";
+			}
+			if (deflate) {
+				uint64_t in = 0, out = 0;
+				for (auto &bot : bots) {
+					if (!bot->game.inflater) continue;
+					in += bot->game.inflater->bytes_in;
+					out += bot->game.inflater->bytes_out;
+				}
+				double in_rate = (in - inflated_in_reported) / elapsed, out_rate = (out - inflated_out_reported) / elapsed;
+				std::cout << "  deflate       " << std::setprecision(1) << in_rate / 1024.0 << " KiB/s of compressed states, expanding to "
+				          << out_rate / 1024.0 << " KiB/s (" << (out_rate > 0.0 ? 100.0 * in_rate / out_rate : 0.0) << "%)\n";
+				inflated_in_reported = in;
+				inflated_out_reported = out;
+			}
+			jitter.report(std::cout, "tick jitter", "ms", 1000.0);
+			latency.report(std::cout, "input latency", "ms", 1000.0);
+			std::cout << "  lost changes  " << changes_lost << " (not seen in a state within " << ChangeTimeout.count() << "s)\n";
+			std::cout.flush();
+			bytes = 0;
+			states = 0;
+			changes_lost = 0;
+			last_report = now;
+		}
+
+		std::this_thread::sleep_for(std::chrono::microseconds(500));
+	}
+
+	return 0;
+}
@@ -4,12 +4,22 @@
 #include "hex_dump.hpp"
 
 #include "Game.hpp"
+#include "WorkerPool.hpp"
+#include "Profiler.hpp"
+#include "NetThread.hpp"
 
 #include <chrono>
 #include <stdexcept>
 #include <iostream>
 #include <cassert>
 #include <unordered_map>
+#include <unordered_set>
+#include <thread>
+#include <algorithm>
+#include <list>
+#include <deque>
+#include <string>
+#include <fstream>
 
 #ifdef _WIN32
 extern "C" { uint32_t GetACP(); }
@@ -32,85 +42,317 @@ int main(int argc, char **argv) {
 
 	//------------ argument parsing ------------
 
-	if (argc != 2) {
-		std::cerr << "Usage:\n\t./server <port>" << std::endl;
+	std::string port;
+	std::string map_file;
+	uint32_t room_size = 16; //players per match
+	uint32_t threads = std::max(1u, std::thread::hardware_concurrency()) - 1; //(in addition to the main thread)
+	double profile_interval = 0.0; //seconds between profile reports (0 => no profiling)
+	std::string profile_file; //where to write profile reports ("" => stdout)
+	Transport transport = Transport::TCP;
+	double drop_rate = 0.0; //fraction of outgoing udp datagrams to drop (for testing)
+	PollBackend backend = PollBackend::Readiness;
+	SendLimits limits; //when to give up on slow clients
+
+	try {
+		for (int argi = 1; argi < argc; ++argi) {
+			std::string arg = argv[argi];
+			if (arg == "--map" && argi + 1 < argc) {
+				map_file = argv[++argi];
+			} else if (arg == "--room-size" && argi + 1 < argc) {
+				room_size = uint32_t(std::stoul(argv[++argi]));
+				if (room_size == 0) throw std::runtime_error("room size must be at least one");
+			} else if (arg == "--threads" && argi + 1 < argc) {
+				threads = uint32_t(std::stoul(argv[++argi]));
+			} else if (arg == "--profile" && argi + 1 < argc) {
+				profile_interval = std::stod(argv[++argi]);
+				if (!(profile_interval > 0.0)) throw std::runtime_error("profile interval must be positive");
+			} else if (arg == "--profile-out" && argi + 1 < argc) {
+				profile_file = argv[++argi];
+			} else if (arg == "--udp") {
+				transport = Transport::UDP;
+			} else if (arg == "--drop" && argi + 1 < argc) {
+				drop_rate = std::stod(argv[++argi]);
+				if (!(drop_rate >= 0.0 && drop_rate < 1.0)) throw std::runtime_error("drop rate must be in [0,1)");
+			} else if (arg == "--io-uring") {
+				backend = PollBackend::IoUring;
+			} else if (arg == "--send-limit" && argi + 1 < argc) {
+				limits.queued_bytes = size_t(std::stoull(argv[++argi])) * 1024;
+				if (limits.queued_bytes == 0) throw std::runtime_error("send limit must be at least 1 KiB");
+			} else if (arg == "--stall-timeout" && argi + 1 < argc) {
+				limits.stall_seconds = std::stod(argv[++argi]);
+				if (!(limits.stall_seconds > 0.0)) throw std::runtime_error("stall timeout must be positive");
+			} else if (port == "" && arg.substr(0, 2) != "--") {
+				port = arg;
+			} else {
+				throw std::runtime_error("unexpected argument '" + arg + "'");
+			}
+		}
+		if (port == "") throw std::runtime_error("expecting a port");
+	} catch (std::exception const &e) {
+		std::cerr << "Error: " << e.what() << "\n";
+		std::cerr << "Usage:\n\t./server <port> [--map map.txt] [--room-size players] [--threads count] [--profile seconds] [--profile-out file] [--udp [--drop fraction] | --io-uring] [--send-limit KiB] [--stall-timeout seconds]" << std::endl;
 		return 1;
 	}
 
 	//------------ initialization ------------
 
-	Server server(argv[1]);
+	//sockets are read, parsed, and written on a thread of their own, so ticks never wait on them:
+	NetThread net(port, transport, drop_rate, backend, limits);
+	if (drop_rate > 0.0) std::cout << "Dropping " << (drop_rate * 100.0) << "% of outgoing datagrams." << std::endl;
+
+	//every match is played on the same map:
+	Map map;
+	if (map_file != "") {
+		map.load(map_file);
+		std::cout << "Loaded " << map.width << "x" << map.height << " map from '" << map_file << "'." << std::endl;
+	}
+	uint64_t map_hash = map.hash(); //(once, rather than per match)
+
+	//match ticks (and per-player update work inside each match) are spread over these threads:
+	WorkerPool workers(threads);
+	std::cout << "Running matches of up to " << room_size << " players on " << (workers.size() + 1) << " threads." << std::endl;
+
+	//per-phase timing, reported every profile_interval seconds:
+	std::ofstream profile_stream;
+	if (profile_file != "") {
+		profile_stream.open(profile_file);
+		if (!profile_stream) throw std::runtime_error("failed to open profile output '" + profile_file + "'");
+	}
+	std::ostream &profile_out = (profile_file != "" ? profile_stream : std::cout);
+	if (profile_interval > 0.0) {
+		Profiler::enabled = true;
+		Profiler::counter("server.tick_overruns"); //(so it is reported even while zero)
+		Profiler::counter("server.inputs_late");
+		Profiler::counter("server.states_held");
+		std::cout << "Profiling; reporting every " << profile_interval << " seconds" << (profile_file != "" ? " to '" + profile_file + "'" : "") << "." << std::endl;
+	}
+	auto next_profile = std::chrono::steady_clock::now() + std::chrono::duration< double >(profile_interval);
 
 	//------------ main loop ------------
 
-	//keep track of which connection is controlling which player:
-	std::unordered_map< Connection *, Player * > connection_to_player;
-	//keep track of game state:
-	Game game;
+	//an independent match, with its own game state and players:
+	struct Room {
+		Game game;
+		//keep track of which connection (by NetThread id) is controlling which player:
+		std::unordered_map< uint32_t, Player::Handle > connection_to_player;
+		//latest state tick each connection has acknowledged (states are sent relative to it):
+		std::unordered_map< uint32_t, uint32_t > acked_tick;
+		//inputs from each connection, applied one client tick per update (how far they got is echoed in states for client-side prediction):
+		std::unordered_map< uint32_t, InputTimeline > inputs;
+		//compression streams of connections that asked for compressed states:
+		std::unordered_map< uint32_t, std::unique_ptr< DeflateStream > > deflaters;
+		//...and the ticks of the compressed states they haven't acknowledged yet:
+		std::unordered_map< uint32_t, std::deque< uint32_t > > unacked;
+		//connections that have been sent the map (it's sent at most once per connection, however often they ask):
+		std::unordered_set< uint32_t > map_sent;
+	};
+	std::list< Room > rooms; //(using list so they can have stable addresses)
+	//compressing clients with this many states sent but not yet acknowledged are sent no more until they catch up:
+	constexpr size_t MaxUnackedStates = size_t(0.5f / Game::Tick);
+	uint32_t next_room_number = 1;
 
-	while (true) {
-		static auto next_tick = std::chrono::steady_clock::now() + std::chrono::duration< double >(Game::Tick);
-		//process incoming data from clients until a tick has elapsed:
-		while (true) {
-			auto now = std::chrono::steady_clock::now();
-			double remain = std::chrono::duration< double >(next_tick - now).count();
-			if (remain < 0.0) {
-				next_tick += std::chrono::duration< double >(Game::Tick);
-				break;
+	//keep track of which match each connection is in:
+	std::unordered_map< uint32_t, Room * > connection_to_room;
+
+	//new connections join the first match with space (or start a new one):
+	auto find_room = [&]() -> Room & {
+		for (auto &room : rooms) {
+			if (room.connection_to_player.size() < room_size) return room;
+		}
+		rooms.emplace_back();
+		Room &room = rooms.back();
+		room.game.set_map(map, map_hash); //(shares the map's blocks, rather than copying them)
+		room.game.workers = &workers;
+		std::cout << "Started match " << next_room_number++ << " (" << rooms.size() << " running)." << std::endl;
+		return room;
+	};
+
+	//helper used when a connection closes (for whatever reason):
+	auto remove_connection = [&](uint32_t c) {
+		auto r = connection_to_room.find(c);
+		if (r == connection_to_room.end()) return;
+		Room &room = *r->second;
+		connection_to_room.erase(r);
+
+		auto f = room.connection_to_player.find(c);
+		assert(f != room.connection_to_player.end());
+		room.game.remove_player(f->second);
+		room.connection_to_player.erase(f);
+		room.acked_tick.erase(c);
+		room.inputs.erase(c);
+		room.deflaters.erase(c);
+		room.unacked.erase(c);
+		room.map_sent.erase(c);
+
+		//matches end when everyone leaves:
+		if (room.connection_to_player.empty()) {
+			for (auto ri = rooms.begin(); ri != rooms.end(); ++ri) {
+				if (&*ri == &room) {
+					rooms.erase(ri);
+					break;
+				}
 			}
+		}
+	};
+
+	std::vector< Room * > tick_rooms; //(rooms as an array, for parallel_for)
+	Connection staging; //(map messages are written here, then handed to the network thread)
+	uint64_t reported_dropped = 0, reported_overflows = 0, reported_delayed = 0, reported_syscalls = 0, reported_superseded = 0, reported_slow = 0; //(net stats already counted)
 
-			//helper used on client close (due to quit) and server close (due to error):
-			auto remove_connection = [&](Connection *c) {
-				auto f = connection_to_player.find(c);
-				assert(f != connection_to_player.end());
-				game.remove_player(f->second);
-				connection_to_player.erase(f);
-			};
+	while (true) {
+		static auto next_tick = std::chrono::steady_clock::now() + std::chrono::duration< double >(Game::Tick);
+		//wait for the next tick (the network thread keeps reading and writing meanwhile):
+		std::this_thread::sleep_until(next_tick);
+		next_tick += std::chrono::duration_cast< std::chrono::steady_clock::duration >(std::chrono::duration< double >(Game::Tick));
 
-			server.poll([&](Connection *c, Connection::Event evt){
-				if (evt == Connection::OnOpen) {
+		//handle everything clients have sent since the last tick:
+		{ PROFILE_SCOPE("server.events");
+			NetThread::Event event;
+			while (net.pop(&event)) {
+				uint32_t c = event.id;
+				if (event.kind == NetThread::Event::Open) {
 					//client connected:
+					Room &room = find_room();
+					connection_to_room.emplace(c, &room);
 
 					//create some player info for them:
-					connection_to_player.emplace(c, game.spawn_player());
+					room.connection_to_player.emplace(c, room.game.spawn_player());
+					room.acked_tick.emplace(c, Game::NoTick);
+					room.inputs.emplace(c, InputTimeline());
 
-				} else if (evt == Connection::OnClose) {
+					//tell them which map is in use (they'll ask for it if they don't have it already):
+					room.game.send_map_info_message(&staging);
+					net.send(c, staging);
+					continue;
+				} else if (event.kind == NetThread::Event::Close) {
 					//client disconnected:
-
 					remove_connection(c);
+					continue;
+				}
 
-				} else { assert(evt == Connection::OnRecv);
-					//got data from client:
-					//std::cout << "current buffer:\n" << hex_dump(c->recv_buffer); std::cout.flush(); //DEBUG
-
-					//look up in players list:
-					auto f = connection_to_player.find(c);
-					assert(f != connection_to_player.end());
-					Player &player = *f->second;
-
-					//handle messages from client:
-					try {
-						bool handled_message;
-						do {
-							handled_message = false;
-							if (player.controls.recv_controls_message(c)) handled_message = true;
-							//TODO: extend for more message types as needed
-						} while (handled_message);
-					} catch (std::exception const &e) {
-						std::cout << "Disconnecting client:" << e.what() << std::endl;
-						c->close();
-						remove_connection(c);
+				//got a message from client:
+				auto r = connection_to_room.find(c);
+				if (r == connection_to_room.end()) continue;
+				Room &room = *r->second;
+				if (event.kind == NetThread::Event::Controls) {
+					InputTimeline &inputs = room.inputs[c];
+					uint64_t late = inputs.late;
+					inputs.receive(event.controls);
+					PROFILE_COUNT("server.controls_messages", 1);
+					if (inputs.late != late) PROFILE_COUNT("server.inputs_late", inputs.late - late);
+				} else if (event.kind == NetThread::Event::MapRequest) {
+					//(a connection's sends arrive in order, so repeating a request can't get the map any sooner)
+					if (!room.map_sent.emplace(c).second) {
+						PROFILE_COUNT("server.map_requests_ignored", 1);
+						continue;
+					}
+					room.game.send_map_message(&staging); //(current map, whichever one they asked for)
+					net.send(c, staging);
+				} else if (event.kind == NetThread::Event::Deflate) {
+					//(over UDP, states may be dropped, which a stream can't survive; those clients just get them uncompressed)
+					if (transport == Transport::TCP && !room.deflaters.count(c)) {
+						room.deflaters.emplace(c, std::make_unique< DeflateStream >());
 					}
+				} else if (event.kind == NetThread::Event::Ack) {
+					//(acks can't be for future ticks; only the newest one matters)
+					uint32_t &acked = room.acked_tick[c];
+					if (event.tick <= room.game.tick && (acked == Game::NoTick || event.tick > acked)) acked = event.tick;
 				}
-			}, remain);
+			}
 		}
 
-		//update current game state
-		game.update(Game::Tick);
+		//update every match and queue its state for its clients, one match per task:
+		// (sends just go into the network thread's queue, so tasks never touch a socket)
+		{ PROFILE_SCOPE("server.tick");
+			tick_rooms.clear();
+			for (auto &room : rooms) {
+				tick_rooms.emplace_back(&room);
+			}
+			workers.parallel_for(uint32_t(tick_rooms.size()), [&](uint32_t begin, uint32_t end) {
+				for (uint32_t i = begin; i < end; ++i) {
+					Room &room = *tick_rooms[i];
 
-		//send updated game state to all clients
-		for (auto &[c, player] : connection_to_player) {
-			game.send_state_message(c, player);
+					//apply each client's inputs for this tick:
+					for (auto &[c, player] : room.connection_to_player) {
+						room.inputs[c].advance(&room.game.players.controls[room.game.players.slot(player)]);
+					}
+
+					//update current game state
+					room.game.update(Game::Tick);
+					room.game.record_snapshot();
+
+					//send updated game state to all clients
+					// (as the changes since the last tick each client acknowledged; serialized once per
+					//  distinct acknowledged tick, and each connection just queues a reference to it)
+					PROFILE_SCOPE("server.send_state");
+					std::unordered_map< uint32_t, SharedBytes > by_baseline;
+					for (auto &[c, player] : room.connection_to_player) {
+						auto deflater = room.deflaters.find(c);
+						//a compressed stream can't have a stale state dropped from its queue (as send_droppable does),
+						// so a compressing client that is far behind on acknowledging states gets none until it catches up:
+						if (deflater != room.deflaters.end()) {
+							std::deque< uint32_t > &unacked = room.unacked[c];
+							uint32_t acked = room.acked_tick[c];
+							while (!unacked.empty() && acked != Game::NoTick && unacked.front() <= acked) unacked.pop_front();
+							if (unacked.size() >= MaxUnackedStates) {
+								PROFILE_COUNT("server.states_held", 1);
+								continue;
+							}
+							unacked.emplace_back(room.game.tick);
+						}
+						uint32_t baseline = room.acked_tick[c];
+						if (!room.game.snapshot_at(baseline)) baseline = Game::NoTick; //(too old: send whole state)
+						SharedBytes &state = by_baseline[baseline];
+						if (!state) {
+							state = room.game.encode_state_message(baseline);
+							if (baseline == Game::NoTick) PROFILE_COUNT("server.states_whole", 1);
+							else PROFILE_COUNT("server.states_delta", 1);
+						}
+						uint8_t header[4 + Game::YouSize];
+						room.game.encode_you_message(player, room.inputs[c].applied, header);
+						if (deflater != room.deflaters.end()) {
+							//(the compressed copy is this connection's alone, and can't be dropped without breaking its stream)
+							PROFILE_SCOPE("server.deflate");
+							DeflateStream &stream = *deflater->second;
+							uint64_t in = stream.bytes_in, out = stream.bytes_out;
+							net.send(c, Game::encode_deflated_message(&stream, header, state));
+							PROFILE_COUNT("server.deflate_bytes_in", stream.bytes_in - in);
+							PROFILE_COUNT("server.deflate_bytes_out", stream.bytes_out - out);
+						} else {
+							net.send_droppable(c, header, sizeof(header), state);
+						}
+					}
+				}
+			}, 1);
+			net.flush();
+		}
+
+		if (profile_interval > 0.0) {
+			auto now = std::chrono::steady_clock::now();
+			//tick work that ran past the start of the next tick delays every later tick:
+			if (now > next_tick) PROFILE_COUNT("server.tick_overruns", 1);
+			PROFILE_COUNT("server.ticks", 1);
+			if (now >= next_profile) {
+				uint64_t dropped = net.droppable_dropped.load(), overflows = net.send_overflows.load(), delayed = net.events_delayed.load();
+				PROFILE_COUNT("net.droppable_dropped", dropped - reported_dropped);
+				PROFILE_COUNT("net.send_overflows", overflows - reported_overflows);
+				PROFILE_COUNT("net.events_delayed", delayed - reported_delayed);
+				//(poll, socket, and io_uring calls made by the network thread; compare with server.ticks)
+				uint64_t syscalls = net.server.poller.syscalls.load();
+				PROFILE_COUNT("net.syscalls", syscalls - reported_syscalls);
+				reported_dropped = dropped;
+				reported_overflows = overflows;
+				reported_delayed = delayed;
+				reported_syscalls = syscalls;
+				//(states a slow client never got because a newer one replaced them in its queue, and clients given up on)
+				uint64_t superseded = net.server.poller.droppable_superseded.load(), slow = net.slow_closed.load();
+				PROFILE_COUNT("net.states_superseded", superseded - reported_superseded);
+				PROFILE_COUNT("net.slow_closed", slow - reported_slow);
+				reported_superseded = superseded;
+				reported_slow = slow;
+				Profiler::dump(profile_out, profile_interval);
+				next_profile = now + std::chrono::duration< double >(profile_interval);
+			}
 		}
 
 	}
@@ -0,0 +1,96 @@
+#include "SnapshotBuffer.hpp"
+
+#include <iostream>
+#include <iomanip>
+#include <random>
+#include <vector>
+#include <string>
+#include <algorithm>
+#include <cmath>
+
+//benchmark for SnapshotBuffer: states sent every Game::Tick arrive with random delays and are drawn at a
+// fixed frame rate; reports underruns (frames with no newer state to move towards) and the biggest jump a
+// remote snake's head makes between frames (smooth motion is 1 cell per tick, i.e., ~0.2 cells per frame):
+//   ./snapshotbuffer-bench [seconds] [frames per second]
+// (arrival delays are |normal(0, jitter)|, so most states are on time and some are a good deal late)
+
+struct Result {
+	uint64_t frames = 0;
+	uint64_t underrun_frames = 0;
+	uint64_t underruns = 0;
+	uint64_t late = 0;
+	float max_step = 0.0f; //largest head movement between frames (cells)
+};
+
+static Result run(float delay_ticks, double jitter, double seconds, double fps, uint32_t seed) {
+	std::mt19937 mt(seed);
+	std::normal_distribution< double > delay(0.0, jitter);
+
+	//one remote snake walking right a cell per tick; state i is sent at i * Tick and arrives a bit later:
+	uint32_t ticks = uint32_t(seconds / Game::Tick);
+	std::vector< std::pair< double, uint32_t > > arrivals; //(time, tick)
+	arrivals.reserve(ticks);
+	for (uint32_t i = 1; i <= ticks; ++i) {
+		arrivals.emplace_back(i * double(Game::Tick) + std::abs(delay(mt)), i);
+	}
+	std::stable_sort(arrivals.begin(), arrivals.end());
+
+	SnapshotBuffer buffer;
+	buffer.delay_ticks = delay_ticks;
+	std::vector< SnapshotBuffer::PlayerView > views;
+	Result result;
+	size_t next = 0;
+	bool have_head = false;
+	glm::vec3 last_head = glm::vec3(0.0f);
+	double frame = 1.0 / fps;
+	for (double now = 0.0; now < seconds; now += frame) {
+		while (next < arrivals.size() && arrivals[next].first <= now) {
+			uint32_t tick = arrivals[next].second;
+			Snapshot snapshot;
+			snapshot.tick = tick;
+			snapshot.players.emplace_back();
+			auto &player = snapshot.players.back();
+			for (uint32_t b = 0; b < 5; ++b) {
+				player.body.emplace_back(int32_t(tick + b), 0, 0);
+			}
+			buffer.push(snapshot);
+			++next;
+		}
+		buffer.advance(float(frame));
+		buffer.sample(&views);
+		if (views.empty() || views[0].body.empty()) continue;
+		glm::vec3 head = views[0].body.back();
+		if (have_head) result.max_step = std::max(result.max_step, std::abs(head.x - last_head.x));
+		last_head = head;
+		have_head = true;
+	}
+
+	result.frames = buffer.frames;
+	result.underrun_frames = buffer.underrun_frames;
+	result.underruns = buffer.underruns;
+	result.late = buffer.late;
+	return result;
+}
+
+int main(int argc, char **argv) {
+	double seconds = (argc >= 2 ? std::stod(argv[1]) : 100.0);
+	double fps = (argc >= 3 ? std::stod(argv[2]) : 144.0);
+	if (argc > 3 || !(seconds > 0.0) || !(fps > 0.0)) {
+		std::cerr << "Usage:\n\t./snapshotbuffer-bench [seconds] [frames per second]" << std::endl;
+		return 1;
+	}
+
+	std::cout << seconds << " s of states every " << (1000.0 * Game::Tick) << " ms, drawn at " << fps << " fps:\n";
+	for (float delay_ticks : { 2.0f, 2.5f, 3.0f }) {
+		for (double jitter_ms : { 0.0, 10.0, 20.0, 40.0 }) {
+			Result result = run(delay_ticks, jitter_ms / 1000.0, seconds, fps, 1);
+			std::cout << std::fixed << std::setprecision(1)
+			          << "  delay " << delay_ticks << " ticks, jitter " << std::setw(4) << jitter_ms << " ms:"
+			          << " underruns " << std::setw(5) << result.underruns
+			          << " (" << std::setw(6) << result.underrun_frames << " of " << result.frames << " frames)"
+			          << ", late " << std::setw(4) << result.late
+			          << std::setprecision(2) << ", max step " << result.max_step << " cells\n";
+		}
+	}
+	return 0;
+}
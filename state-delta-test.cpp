@@ -0,0 +1,147 @@
+#include "Game.hpp"
+
+#include <iostream>
+#include <random>
+#include <vector>
+#include <deque>
+#include <string>
+#include <cstdint>
+
+//round-trip test for state messages: a server Game runs matches (with players joining and leaving), encodes
+// each tick's state relative to the tick the client last acknowledged (some acks are lost, some states are
+// forced whole), and a client Game decodes them; every decoded state must match the server's exactly:
+//   ./state-delta-test [seed]
+
+static uint32_t failures = 0;
+
+static void check(bool ok, std::string const &what) {
+	if (ok) return;
+	std::cerr << "FAILED: " << what << std::endl;
+	failures += 1;
+}
+
+//compare a decoded state to the server's:
+static bool same_state(Snapshot const &got, Snapshot const &want, std::string const &name) {
+	uint32_t before = failures;
+	check(got.tick == want.tick, name + ": tick " + std::to_string(got.tick) + ", expected " + std::to_string(want.tick));
+	check(got.apples.size() == want.apples.size(), name + ": " + std::to_string(got.apples.size()) + " apples, expected " + std::to_string(want.apples.size()));
+	for (size_t a = 0; a < got.apples.size() && a < want.apples.size(); ++a) {
+		if (got.apples[a].position != want.apples[a].position || got.apples[a].type != want.apples[a].type) {
+			check(false, name + ": apple " + std::to_string(a) + " differs");
+			break;
+		}
+	}
+	check(got.players.size() == want.players.size(), name + ": " + std::to_string(got.players.size()) + " players, expected " + std::to_string(want.players.size()));
+	for (size_t p = 0; p < got.players.size() && p < want.players.size(); ++p) {
+		Snapshot::PlayerState const &g = got.players[p];
+		Snapshot::PlayerState const &w = want.players[p];
+		std::string who = name + ": player " + std::to_string(p);
+		if (g.color != w.color || g.name != w.name) check(false, who + " has the wrong color or name");
+		if (g.move_dir != w.move_dir || g.zHeight != w.zHeight || g.alive != w.alive) check(false, who + " has the wrong move_dir, zHeight, or alive");
+		if (g.body != w.body) check(false, who + " has the wrong body (" + std::to_string(g.body.size()) + " blocks, expected " + std::to_string(w.body.size()) + ")");
+		if (failures - before > 8) break; //(enough to see what's wrong)
+	}
+	return failures == before;
+}
+
+//run one match of 'count' players for 'ticks' ticks, checking every state the client decodes:
+static void run(std::mt19937 &mt, uint32_t count, uint32_t ticks, uint32_t map_size, std::string const &name) {
+	Game server;
+	Map map;
+	map.resize(map_size, map_size);
+	for (uint32_t i = 0; i < map_size * map_size / 50; ++i) {
+		map.set(int(mt() % map_size), int(mt() % map_size), B);
+	}
+	server.set_map(map, map.hash());
+
+	std::vector< Player::Handle > handles;
+	for (uint32_t i = 0; i < count; ++i) {
+		handles.emplace_back(server.spawn_player());
+	}
+
+	Game client;
+	client.map = server.map; //(so the client doesn't ask for it)
+	client.map_hash = server.map_hash;
+
+	uint32_t acked = Game::NoTick; //newest tick the server has heard the client acknowledge
+	uint64_t delta_bytes = 0, whole_bytes = 0;
+	uint32_t deltas = 0, wholes = 0;
+	for (uint32_t t = 0; t < ticks; ++t) {
+		//random steering and jumping:
+		for (auto const &handle : handles) {
+			Player::Controls &controls = server.players.controls[server.players.slot(handle)];
+			uint32_t r = mt();
+			controls.left.pressed = (r % 8 == 0);
+			controls.right.pressed = (r % 8 == 1);
+			controls.up.pressed = (r % 8 == 2);
+			controls.down.pressed = (r % 8 == 3);
+			controls.jump.pressed = ((r >> 3) % 16 == 0);
+		}
+		//players leave and join now and then (so deltas see players come and go, and slots shift):
+		if (mt() % 10 == 0 && !handles.empty()) {
+			size_t leaving = mt() % handles.size();
+			server.remove_player(handles[leaving]);
+			handles.erase(handles.begin() + leaving);
+		}
+		if (mt() % 10 == 0) handles.emplace_back(server.spawn_player());
+
+		server.update(Game::Tick);
+		server.record_snapshot();
+
+		//the state, relative to the client's last acknowledged tick (or whole, now and then):
+		uint32_t baseline = (mt() % 40 == 0 ? Game::NoTick : acked);
+		SharedBytes state = server.encode_state_message(baseline);
+		if (server.snapshot_at(baseline)) {
+			delta_bytes += state->size();
+			deltas += 1;
+		} else {
+			whole_bytes += state->size();
+			wholes += 1;
+		}
+
+		//(as send_state_message would queue them)
+		uint8_t you[4 + Game::YouSize];
+		server.encode_you_message(Player::Handle(), 0, you);
+		Connection link;
+		link.recv_buffer.append(you, sizeof(you));
+		link.recv_buffer.append(state->data(), state->size());
+
+		std::string at = name + ", tick " + std::to_string(t);
+		try {
+			bool read = client.recv_state_message(&link);
+			check(read, at + ": state wasn't read");
+			check(link.recv_buffer.size() == 0, at + ": " + std::to_string(link.recv_buffer.size()) + " bytes left over");
+			if (!read || !same_state(client.received.back(), server.history.back(), at)) return;
+		} catch (std::exception const &e) {
+			check(false, at + ": read threw '" + std::string(e.what()) + "'");
+			return;
+		}
+
+		//the client acknowledges every state; some acks are lost on the way:
+		Connection back;
+		back.recv_buffer.append(link.send_buffer.data(), link.send_buffer.size());
+		uint32_t tick = 0;
+		check(Game::recv_ack_message(&back, &tick) && tick == server.tick, at + ": client didn't acknowledge the state");
+		if (mt() % 4 != 0) acked = tick;
+	}
+
+	std::cout << "  " << name << ": " << deltas << " delta states (" << (deltas ? delta_bytes / deltas : 0) << " bytes each), "
+	          << wholes << " whole states (" << (wholes ? whole_bytes / wholes : 0) << " bytes each)" << std::endl;
+}
+
+int main(int argc, char **argv) {
+	uint32_t seed = (argc >= 2 ? uint32_t(std::stoul(argv[1])) : 1);
+	std::mt19937 mt(seed);
+
+	run(mt, 1, 200, 16, "1 player");
+	run(mt, 12, 600, 48, "12 players");
+	//(more players than fit in a byte, as in a big arena)
+	run(mt, 300, 300, 128, "300 players");
+
+	if (failures) {
+		std::cerr << failures << " failure(s) (seed " << seed << ")." << std::endl;
+		return 1;
+	}
+	std::cout << "State delta round trips passed (seed " << seed << ")." << std::endl;
+	return 0;
+}
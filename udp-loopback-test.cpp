@@ -0,0 +1,190 @@
+#include "Connection.hpp"
+
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstring>
+
+//loopback test for the UDP transport: a Server and a Client on 127.0.0.1, both dropping a fraction of
+// outgoing datagrams, exchange reliable messages (which must all arrive, in order and intact) while the
+// server also sends droppable messages (which may be lost, but must never arrive after a newer one):
+//   ./udp-loopback-test [port] [drop rate]
+
+//messages are framed as the game's are, [type:1][size:3][payload]:
+// 'R' reliable:  [index:4][bytes] (bytes follow a pattern from the index; sizes vary, so many span several datagrams)
+// 'D' droppable: [seq:4][bytes]
+static const uint32_t Reliables = 400; //(in each direction)
+static const uint32_t MaxReliableSize = 20000;
+
+static uint32_t reliable_size(uint32_t index) {
+	//mostly small, with a big one now and then:
+	return (index % 16 == 0 ? (index * 7919u) % MaxReliableSize : (index * 131u) % 600);
+}
+
+static uint8_t pattern(uint32_t index, uint32_t i) {
+	return uint8_t(index * 31u + i * 7u + (i >> 8));
+}
+
+static void send_reliable(Connection &c, uint32_t index) {
+	uint32_t size = 4 + reliable_size(index);
+	std::vector< uint8_t > message(4 + size);
+	message[0] = 'R';
+	message[1] = uint8_t(size);
+	message[2] = uint8_t(size >> 8);
+	message[3] = uint8_t(size >> 16);
+	std::memcpy(message.data() + 4, &index, 4);
+	for (uint32_t i = 0; i + 4 < size; ++i) {
+		message[8 + i] = pattern(index, i);
+	}
+	c.send_raw(message.data(), message.size());
+}
+
+//checks messages as they arrive on one end:
+struct Receiver {
+	std::string name;
+	uint32_t reliables = 0; //reliable messages received (so, also the index expected next)
+	uint32_t droppables = 0; //droppable messages received
+	uint32_t last_seq = 0; //seq of the newest droppable message received
+	uint32_t failures = 0;
+
+	void fail(std::string const &what) {
+		std::cerr << "FAILED [" << name << "]: " << what << std::endl;
+		failures += 1;
+	}
+
+	void parse(ByteQueue &recv_buffer) {
+		while (recv_buffer.size() >= 4) {
+			uint32_t size = (uint32_t(recv_buffer[3]) << 16) | (uint32_t(recv_buffer[2]) << 8) | uint32_t(recv_buffer[1]);
+			if (recv_buffer.size() < 4 + size) break;
+			uint8_t type = recv_buffer[0];
+			uint32_t index = 0;
+			if (size >= 4) std::memcpy(&index, &recv_buffer[4], 4);
+
+			if (type == 'R') {
+				if (index != reliables) {
+					fail("reliable message " + std::to_string(index) + " arrived when expecting " + std::to_string(reliables));
+				} else if (size != 4 + reliable_size(index)) {
+					fail("reliable message " + std::to_string(index) + " has size " + std::to_string(size) + ", expected " + std::to_string(4 + reliable_size(index)));
+				} else {
+					for (uint32_t i = 0; i + 4 < size; ++i) {
+						if (recv_buffer[8 + i] != pattern(index, i)) {
+							fail("reliable message " + std::to_string(index) + " differs at byte " + std::to_string(i));
+							break;
+						}
+					}
+				}
+				reliables = index + 1;
+			} else if (type == 'D') {
+				if (size < 4 || index <= last_seq) {
+					fail("droppable message " + std::to_string(index) + " arrived after " + std::to_string(last_seq));
+				}
+				for (uint32_t i = 4; i < size; ++i) {
+					if (recv_buffer[4 + i] != pattern(index, i)) {
+						fail("droppable message " + std::to_string(index) + " differs at byte " + std::to_string(i));
+						break;
+					}
+				}
+				last_seq = index;
+				droppables += 1;
+			} else {
+				fail("unexpected message type " + std::to_string(int(type)));
+			}
+			recv_buffer.consume(4 + size);
+		}
+	}
+};
+
+int main(int argc, char **argv) {
+	std::string port = (argc >= 2 ? argv[1] : "15871");
+	double drop_rate = (argc >= 3 ? std::stod(argv[2]) : 0.2);
+	if (argc > 3 || !(drop_rate >= 0.0 && drop_rate < 1.0)) {
+		std::cerr << "Usage:\n\t./udp-loopback-test [port] [drop rate]" << std::endl;
+		return 1;
+	}
+
+	auto timeout = std::chrono::steady_clock::now() + std::chrono::seconds(60);
+	auto timed_out = [&]() { return std::chrono::steady_clock::now() > timeout; };
+
+	//the server runs on its own thread, since Client's constructor waits to be welcomed:
+	Server server(port, Transport::UDP);
+	server.poller.drop_rate = drop_rate;
+	server.poller.drop_rng.seed(1);
+
+	Receiver at_server;
+	at_server.name = "server";
+	std::atomic< bool > client_done(false);
+	std::atomic< bool > server_done(false);
+	std::thread server_thread([&]() {
+		Connection *client = nullptr;
+		uint32_t sent = 0;
+		uint32_t seq = 0;
+		while (!client_done && !timed_out()) {
+			server.poll([&](Connection *c, Connection::Event event) {
+				if (event == Connection::OnOpen) client = c;
+				else if (event == Connection::OnClose) client = nullptr;
+				else if (event == Connection::OnRecv) at_server.parse(c->recv_buffer);
+			}, 0.002);
+			if (!client) continue;
+
+			//a few reliable messages per poll, interleaved with a droppable one (sometimes several datagrams long):
+			for (uint32_t i = 0; i < 4 && sent < Reliables; ++i) {
+				send_reliable(*client, sent++);
+			}
+			seq += 1;
+			uint32_t size = 4 + (seq % 8 == 0 ? 3000 : 40);
+			auto bytes = std::make_shared< std::vector< uint8_t > >(size - 4);
+			for (uint32_t i = 4; i < size; ++i) (*bytes)[i - 4] = pattern(seq, i);
+			uint8_t prefix[8] = { 'D', uint8_t(size), uint8_t(size >> 8), uint8_t(size >> 16) };
+			std::memcpy(prefix + 4, &seq, 4);
+			client->send_droppable(prefix, sizeof(prefix), bytes);
+
+			if (at_server.reliables == Reliables) server_done = true;
+		}
+	});
+
+	Receiver at_client;
+	at_client.name = "client";
+	try {
+		Client client("127.0.0.1", port, Transport::UDP);
+		client.poller.drop_rate = drop_rate;
+		client.poller.drop_rng.seed(2);
+
+		uint32_t sent = 0;
+		while (!(server_done && at_client.reliables == Reliables) && !timed_out()) {
+			for (uint32_t i = 0; i < 4 && sent < Reliables; ++i) {
+				send_reliable(client.connection, sent++);
+			}
+			client.poll([&](Connection *c, Connection::Event event) {
+				if (event == Connection::OnRecv) at_client.parse(c->recv_buffer);
+			}, 0.002);
+		}
+	} catch (std::exception const &e) {
+		at_client.fail(std::string("client threw '") + e.what() + "'");
+	}
+	client_done = true;
+	server_thread.join();
+
+	uint32_t failures = at_server.failures + at_client.failures;
+	if (timed_out()) {
+		std::cerr << "FAILED: timed out with " << at_client.reliables << " / " << at_server.reliables << " of " << Reliables
+		          << " reliable messages received by client / server." << std::endl;
+		failures += 1;
+	}
+	if (at_client.droppables == 0) {
+		std::cerr << "FAILED: no droppable messages arrived." << std::endl;
+		failures += 1;
+	}
+
+	std::cout << "Received " << at_client.reliables << " / " << at_server.reliables << " reliable messages (client / server) and "
+	          << at_client.droppables << " of " << at_client.last_seq << " droppable messages, dropping " << drop_rate << " of datagrams." << std::endl;
+	if (failures) {
+		std::cerr << failures << " failure(s)." << std::endl;
+		return 1;
+	}
+	std::cout << "UDP loopback test passed." << std::endl;
+	return 0;
+}